@@ -0,0 +1,378 @@
+#include "batch.h"
+#include "chunked.h"
+#include "io.h"
+#include "lz78.h"
+#include "pool.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+// what the workers of a batch share
+typedef struct Run {
+    BatchFile *files;
+    int count;
+    int next; // Next file to hand out.
+    const LZ78Options *opts;
+    const LZ78Dict *dict;
+    bool check; // Decompress without writing anything.
+    LZ78Stats *stats;
+    pthread_mutex_t lock;
+} Run;
+
+// hand out the next file, -1 once they're all taken
+static int take(Run *r) {
+    pthread_mutex_lock(&r->lock);
+    int i = r->next < r->count ? r->next : -1;
+    r->next += i != -1;
+    pthread_mutex_unlock(&r->lock);
+    return i;
+}
+
+// add a worker's totals to the batch's
+static void merge(Run *r, const LZ78Stats *total) {
+    pthread_mutex_lock(&r->lock);
+    lz78_stats_merge(r->stats, total);
+    pthread_mutex_unlock(&r->lock);
+}
+
+// path with suffix added, or taken off if strip and path ends in it
+static char *out_path(const char *path, const char *suffix, bool strip) {
+    size_t len = strlen(path);
+    size_t suffix_len = strlen(suffix);
+    if (strip && len > suffix_len && strcmp(path + len - suffix_len, suffix) == 0) {
+        return strndup(path, len - suffix_len);
+    }
+    char *out = malloc(len + strlen(BATCH_OTHER) + suffix_len + 1);
+    if (out) {
+        strcpy(out, path);
+        strcpy(out + len, strip ? BATCH_OTHER : suffix);
+    }
+    return out;
+}
+
+// note why a file failed, keeping errno for I/O errors
+static void fail(BatchFile *f, LZ78Status status, bool io) {
+    f->status = status;
+    f->err = io ? errno : 0;
+}
+
+// feed all of infile to update, from its current offset, timing the reads
+static LZ78Status feed(int infile, LZ78Status (*update)(void *, const uint8_t *, size_t),
+    void *codec, uint64_t *read_ns) {
+    LZ78Status status = LZ78_OK;
+    Mapping map;
+    uint64_t t = clock_ns();
+    if (map_file(infile, &map)) {
+        // regular file, go through it in place
+        *read_ns += clock_ns() - t;
+        status = update(codec, map.data, map.len);
+        unmap_file(&map);
+        return status;
+    }
+    uint8_t block[BLOCK];
+    int bytes_read = 0;
+    while (status == LZ78_OK && (bytes_read = read_bytes(infile, block, BLOCK)) > 0) {
+        *read_ns += clock_ns() - t;
+        status = update(codec, block, bytes_read);
+        t = clock_ns();
+    }
+    *read_ns += clock_ns() - t;
+    return status;
+}
+
+static LZ78Status encoder_update(void *enc, const uint8_t *buf, size_t len) {
+    return lz78_encoder_update(enc, buf, len);
+}
+
+static LZ78Status decoder_update(void *dec, const uint8_t *buf, size_t len) {
+    return lz78_decoder_update(dec, buf, len);
+}
+
+// compress one file of the batch, with the worker's encoder if it has one yet
+static void encode_file(Run *r, BatchFile *f, LZ78Encoder **enc, LZ78Stats *total) {
+    uint64_t start = clock_ns();
+    int infile = open(f->path, O_RDONLY);
+    struct stat st;
+    if (infile == -1 || fstat(infile, &st) == -1) {
+        fail(f, LZ78_ERR_INPUT, true);
+        if (infile != -1) {
+            close(infile);
+        }
+        return;
+    }
+    // never over an existing file, a batch names its outputs itself
+    char *path = out_path(f->path, BATCH_SUFFIX, false);
+    int outfile = path ? open(path, O_WRONLY | O_CREAT | O_EXCL, 0600) : -1;
+    if (outfile == -1) {
+        fail(f, path ? LZ78_ERR_SINK : LZ78_ERR_MEMORY, path != NULL);
+        close(infile);
+        free(path);
+        return;
+    }
+    // make permission for outfile match protection bits of infile
+    fchmod(outfile, st.st_mode);
+
+    // the encoder writes to outfile, timing the writes
+    // the length of a regular file goes in the header for the decoder
+    TimedSink out = { fd_sink, &outfile, 0 };
+    uint64_t length = S_ISREG(st.st_mode) ? (uint64_t) st.st_size : LZ78_UNKNOWN_LENGTH;
+    LZ78Status status = LZ78_OK;
+    if (*enc) {
+        status = lz78_encoder_restart(*enc, st.st_mode, length, timed_sink, &out);
+    } else {
+        LZ78Options opts = *r->opts;
+        opts.protection = st.st_mode;
+        opts.length = length;
+        *enc = lz78_encoder_create(&opts, timed_sink, &out);
+        status = *enc ? LZ78_OK : LZ78_ERR_MEMORY;
+    }
+    LZ78Stats stats = { 0 };
+    uint64_t read_ns = 0;
+    if (status == LZ78_OK) {
+        status = feed(infile, encoder_update, *enc, &read_ns);
+        if (status == LZ78_OK) {
+            status = lz78_encoder_finish(*enc);
+        }
+        lz78_encoder_stats(*enc, &stats);
+    }
+    close(infile);
+    if (close(outfile) == -1 && status == LZ78_OK) {
+        status = LZ78_ERR_SINK;
+    }
+    if (status != LZ78_OK) {
+        fail(f, status, status == LZ78_ERR_SINK);
+        unlink(path);
+    }
+    free(path);
+    stats.read_ns = read_ns;
+    stats.write_ns = out.ns;
+    stats.codec_ns = clock_ns() - start - read_ns - out.ns;
+    lz78_stats_merge(total, &stats);
+}
+
+// job: worker w compresses files until there are none left
+static void encode_worker(void *arg, int w) {
+    (void) w;
+    Run *r = arg;
+    LZ78Encoder *enc = NULL;
+    LZ78Stats total = { 0 };
+    int i = 0;
+    while ((i = take(r)) != -1) {
+        encode_file(r, &r->files[i], &enc, &total);
+    }
+    lz78_encoder_delete(enc);
+    merge(r, &total);
+}
+
+// decompress one file of the batch, with the worker's decoder if it has one yet
+static void decode_file(Run *r, BatchFile *f, LZ78Decoder **dec, LZ78Stats *total) {
+    uint64_t start = clock_ns();
+    int infile = open(f->path, O_RDONLY);
+    if (infile == -1) {
+        fail(f, LZ78_ERR_INPUT, true);
+        return;
+    }
+    // a check has no output to open
+    char *path = NULL;
+    int outfile = -1;
+    if (!r->check) {
+        path = out_path(f->path, BATCH_SUFFIX, true);
+        outfile = path ? open(path, O_WRONLY | O_CREAT | O_EXCL, 0600) : -1;
+        if (outfile == -1) {
+            fail(f, path ? LZ78_ERR_SINK : LZ78_ERR_MEMORY, path != NULL);
+            close(infile);
+            free(path);
+            return;
+        }
+    }
+
+    // read in the header to tell a chunked container from a single stream
+    uint8_t head[HEADER_MAX];
+    int head_len = read_bytes(infile, head, HEADER_SIZE);
+    FileHeader header;
+    read_header(head, &header);
+    LZ78Stats stats = { 0 };
+    LZ78Status status = LZ78_OK;
+    if (head_len == HEADER_SIZE && header.magic == MAGIC_CHUNKED) {
+        // make permission for outfile match protection bits in fileheader
+        if (outfile != -1) {
+            fchmod(outfile, header.protection);
+        }
+        status = chunked_decode(infile, outfile, head, 1, r->dict, &stats);
+    } else {
+        // the decoder writes to outfile, timing the writes
+        TimedSink out = { outfile == -1 ? null_sink : fd_sink, &outfile, 0 };
+        if (*dec) {
+            lz78_decoder_restart(*dec, timed_sink, &out);
+        } else {
+            *dec = lz78_decoder_create(timed_sink, &out);
+            status = *dec ? LZ78_OK : LZ78_ERR_MEMORY;
+        }
+        uint64_t read_ns = 0;
+        if (status == LZ78_OK) {
+            lz78_decoder_use_dict(*dec, r->dict);
+            // the header comes first, read in whole so its length is known up front
+            if (head_len == HEADER_SIZE && header.magic == MAGIC) {
+                int rest = header_size(header.flags) - HEADER_SIZE;
+                head_len += read_bytes(infile, head + HEADER_SIZE, rest);
+            }
+            status = lz78_decoder_update(*dec, head, head_len);
+            const FileHeader *stream = lz78_decoder_header(*dec);
+            if (status == LZ78_OK && stream && outfile != -1) {
+                fchmod(outfile, stream->protection);
+                // only as much as the rest of the input can come to
+                uint64_t left = file_left(infile);
+                if (stream->flags & FLAG_SIZE && left != UINT64_MAX) {
+                    uint64_t bound = lz78_max_length(stream, left + head_len);
+                    preallocate(outfile, stream->length < bound ? stream->length : bound);
+                }
+            }
+            if (status == LZ78_OK) {
+                status = feed(infile, decoder_update, *dec, &read_ns);
+            }
+            if (status == LZ78_OK) {
+                status = lz78_decoder_finish(*dec);
+            }
+            lz78_decoder_stats(*dec, &stats);
+        }
+        stats.read_ns = read_ns;
+        stats.write_ns = out.ns;
+        stats.codec_ns = clock_ns() - start - read_ns - out.ns;
+    }
+    close(infile);
+    if (outfile != -1 && close(outfile) == -1 && status == LZ78_OK) {
+        status = LZ78_ERR_SINK;
+    }
+    if (status != LZ78_OK) {
+        fail(f, status, status == LZ78_ERR_SINK);
+        if (path) {
+            unlink(path);
+        }
+    }
+    free(path);
+    lz78_stats_merge(total, &stats);
+}
+
+// job: worker w decompresses files until there are none left
+static void decode_worker(void *arg, int w) {
+    (void) w;
+    Run *r = arg;
+    LZ78Decoder *dec = NULL;
+    LZ78Stats total = { 0 };
+    int i = 0;
+    while ((i = take(r)) != -1) {
+        decode_file(r, &r->files[i], &dec, &total);
+    }
+    lz78_decoder_delete(dec);
+    merge(r, &total);
+}
+
+// add a copy of path to a list
+static bool add_file(BatchFile **files, int *count, int *cap, const char *path) {
+    if (*count == *cap) {
+        int grown_cap = *cap ? *cap * 2 : 64;
+        BatchFile *grown = realloc(*files, grown_cap * sizeof(BatchFile));
+        if (!grown) {
+            return false;
+        }
+        *files = grown;
+        *cap = grown_cap;
+    }
+    BatchFile *f = &(*files)[*count];
+    memset(f, 0, sizeof(BatchFile));
+    f->path = strdup(path);
+    if (!f->path) {
+        return false;
+    }
+    *count += 1;
+    return true;
+}
+
+// list files from names or stdin
+bool batch_list(char **names, int count, BatchFile **files, int *listed) {
+    BatchFile *list = NULL;
+    int n = 0;
+    int cap = 0;
+    bool ok = true;
+    for (int i = 0; i < count && ok; i += 1) {
+        ok = add_file(&list, &n, &cap, names[i]);
+    }
+    if (count == 0) {
+        // one path per line, blank lines skipped
+        char *line = NULL;
+        size_t line_cap = 0;
+        ssize_t len = 0;
+        while (ok && (len = getline(&line, &line_cap, stdin)) != -1) {
+            if (len > 0 && line[len - 1] == '\n') {
+                line[len - 1] = '\0';
+                len -= 1;
+            }
+            ok = len == 0 || add_file(&list, &n, &cap, line);
+        }
+        ok = ok && !ferror(stdin);
+        free(line);
+    }
+    if (!ok) {
+        batch_free(list, n);
+        return false;
+    }
+    *files = list;
+    *listed = n;
+    return true;
+}
+
+// free a list of files
+void batch_free(BatchFile *files, int count) {
+    for (int i = 0; files && i < count; i += 1) {
+        free(files[i].path);
+    }
+    free(files);
+}
+
+// run a batch on up to threads workers
+static LZ78Status run_batch(Run *r, Job worker, int threads) {
+    memset(r->stats, 0, sizeof(LZ78Stats));
+    for (int i = 0; i < r->count; i += 1) {
+        r->files[i].status = LZ78_OK;
+        r->files[i].err = 0;
+    }
+    // a worker per thread, never more workers than files
+    int workers = threads < r->count ? threads : r->count;
+    Pool *pool = workers ? pool_create(workers) : NULL;
+    if (workers && !pool) {
+        return LZ78_ERR_MEMORY;
+    }
+    if (pool) {
+        pool_run(pool, worker, r, workers);
+    }
+    pool_delete(pool);
+    pthread_mutex_destroy(&r->lock);
+    for (int i = 0; i < r->count; i += 1) {
+        if (r->files[i].status != LZ78_OK) {
+            return r->files[i].status;
+        }
+    }
+    return LZ78_OK;
+}
+
+// compress many files
+LZ78Status batch_encode(
+    BatchFile *files, int count, const LZ78Options *opts, int threads, LZ78Stats *stats) {
+    Run r = { files, count, 0, opts, NULL, false, stats, PTHREAD_MUTEX_INITIALIZER };
+    return run_batch(&r, encode_worker, threads);
+}
+
+// decompress many files
+LZ78Status batch_decode(BatchFile *files, int count, const LZ78Dict *dict, bool check,
+    int threads, LZ78Stats *stats) {
+    Run r = { files, count, 0, NULL, dict, check, stats, PTHREAD_MUTEX_INITIALIZER };
+    return run_batch(&r, decode_worker, threads);
+}
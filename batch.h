@@ -0,0 +1,60 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include "lz78.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#define BATCH_SUFFIX ".lz" // Added to compressed files, taken off decompressed ones.
+#define BATCH_OTHER ".out" // Added to decompressed files that lack BATCH_SUFFIX.
+
+/*
+ * A file of a batch and how it went
+ * err is the errno of a failed open, read or write, 0 if status says it all
+ */
+typedef struct BatchFile {
+    char *path;
+    LZ78Status status;
+    int err;
+} BatchFile;
+
+/*
+ * Lists the count files named in names, or if count is 0 the files named on
+ * stdin one per line, in *files and their number in *listed
+ * Returns false if out of memory or stdin couldn't be read
+ */
+bool batch_list(char **names, int count, BatchFile **files, int *listed);
+
+/*
+ * Frees a list made by batch_list()
+ */
+void batch_free(BatchFile *files, int count);
+
+/*
+ * Compresses every file of files into a file of its own with BATCH_SUFFIX
+ * added, with the protection bits of the original
+ * A file whose output already exists fails, the existing file is left alone
+ * Files are shared out to threads workers as they free up, each worker
+ * keeps one encoder and its dictionary memory for all the files it takes
+ * Fills stats with the totals over all files, timings summed over workers
+ * Returns LZ78_OK if every file was compressed, the status of the first
+ * failure otherwise, each file's status is left in files
+ */
+LZ78Status batch_encode(
+    BatchFile *files, int count, const LZ78Options *opts, int threads, LZ78Stats *stats);
+
+/*
+ * Decompresses every file of files into a file of its own with BATCH_SUFFIX
+ * taken off, or BATCH_OTHER added if it lacks BATCH_SUFFIX, with the
+ * protection bits recorded in its header, existing outputs are left alone
+ * Single streams are decompressed by a decoder each worker keeps for all
+ * its files, chunked containers by chunked_decode()
+ * dict is used by files compressed with a pretrained dictionary, may be NULL
+ * With check set files are only checked, nothing is written
+ * Output of files that fail is removed
+ * Returns and fills stats as batch_encode() does
+ */
+LZ78Status batch_decode(BatchFile *files, int count, const LZ78Dict *dict, bool check,
+    int threads, LZ78Stats *stats);
+
+#endif
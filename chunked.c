@@ -0,0 +1,449 @@
+#include "chunked.h"
+#include "code.h"
+#include "endian.h"
+#include "io.h"
+#include "lz78.h"
+#include "pool.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// a chunk moving through a batch
+typedef struct Chunk {
+    uint8_t *raw;
+    size_t raw_len;
+    uint8_t *comp;
+    size_t comp_len;
+    uint64_t offset; // Where the frame starts, when read through the index.
+    bool mapped; // comp points into the mapped input rather than the heap.
+    LZ78Stats stats;
+    LZ78Status status;
+} Chunk;
+
+// what the jobs of a batch share
+typedef struct Batch {
+    Chunk *chunks;
+    const LZ78Options *opts;
+    int infile;
+    off_t base; // Where the container starts in infile.
+    const uint8_t *map; // Start of infile if it's mapped.
+    size_t map_size;
+    const LZ78Dict *dict; // For decompressing chunks that use one.
+} Batch;
+
+// Reads in bytes at offset until all bytes specified are actually read
+static bool pread_bytes(int infile, uint8_t *buf, size_t to_read, off_t offset) {
+    size_t total_read = 0;
+    while (total_read != to_read) {
+        ssize_t curr_read
+            = pread(infile, buf + total_read, to_read - total_read, offset + total_read);
+        if (curr_read <= 0) {
+            return false;
+        }
+        total_read += curr_read;
+    }
+    return true;
+}
+
+// read the compressed bytes of a frame off infile, growing the buffer as they
+// arrive, so a corrupt length can't claim more memory than there is input
+static LZ78Status read_frame(int infile, Chunk *c) {
+    Buffer buf = { 0 };
+    while (buf.len < c->comp_len) {
+        size_t want = c->comp_len - buf.len < CHUNK_SIZE ? c->comp_len - buf.len : CHUNK_SIZE;
+        size_t cap = 2 * buf.cap > buf.len + want ? 2 * buf.cap : buf.len + want;
+        if (!buffer_reserve(&buf, cap)) {
+            free(buf.data);
+            return LZ78_ERR_MEMORY;
+        }
+        if (read_bytes(infile, buf.data + buf.len, want) != (int) want) {
+            free(buf.data);
+            return LZ78_ERR_TRUNCATED;
+        }
+        buf.len += want;
+    }
+    c->comp = buf.data ? buf.data : malloc(1);
+    return c->comp ? LZ78_OK : LZ78_ERR_MEMORY;
+}
+
+// job: compress chunk i of the batch into its own LZ78 stream
+static void compress_chunk(void *arg, int i) {
+    Batch *b = arg;
+    Chunk *c = &b->chunks[i];
+    Buffer out = { 0 };
+    LZ78Encoder *enc = lz78_encoder_create(b->opts, buffer_sink, &out);
+    if (!enc) {
+        c->status = LZ78_ERR_MEMORY;
+        return;
+    }
+    c->status = lz78_encoder_update(enc, c->raw, c->raw_len);
+    if (c->status == LZ78_OK) {
+        c->status = lz78_encoder_finish(enc);
+    }
+    lz78_encoder_stats(enc, &c->stats);
+    lz78_encoder_delete(enc);
+    c->comp = out.data;
+    c->comp_len = out.len;
+}
+
+// job: decompress chunk i of the batch, reading it through the index if needed
+static void decompress_chunk(void *arg, int i) {
+    Batch *b = arg;
+    Chunk *c = &b->chunks[i];
+    if (!c->comp && b->map) {
+        // mapped input, decompress the chunk in place
+        if (b->base + c->offset + FRAME_SIZE + c->comp_len > b->map_size) {
+            c->status = LZ78_ERR_CORRUPT;
+            return;
+        }
+        c->comp = (uint8_t *) b->map + b->base + c->offset + FRAME_SIZE;
+        c->mapped = true;
+    } else if (!c->comp) {
+        c->comp = malloc(c->comp_len ? c->comp_len : 1);
+        if (!c->comp) {
+            c->status = LZ78_ERR_MEMORY;
+            return;
+        }
+        if (!pread_bytes(b->infile, c->comp, c->comp_len, b->base + c->offset + FRAME_SIZE)) {
+            c->status = LZ78_ERR_TRUNCATED;
+            return;
+        }
+    }
+    // the frame says how much the chunk decompresses to, so output is sized once
+    Buffer out = { 0 };
+    LZ78Decoder *dec = lz78_decoder_create(buffer_sink, &out);
+    if (!dec || !buffer_reserve(&out, c->raw_len)) {
+        lz78_decoder_delete(dec);
+        c->status = LZ78_ERR_MEMORY;
+        return;
+    }
+    lz78_decoder_use_dict(dec, b->dict);
+    c->status = lz78_decoder_update(dec, c->comp, c->comp_len);
+    if (c->status == LZ78_OK) {
+        c->status = lz78_decoder_finish(dec);
+    }
+    lz78_decoder_stats(dec, &c->stats);
+    lz78_decoder_delete(dec);
+    if (c->status == LZ78_OK && out.len != c->raw_len) {
+        c->status = LZ78_ERR_CORRUPT;
+    }
+    c->raw = out.data;
+}
+
+// compress infile into a chunked container
+LZ78Status chunked_encode(int infile, int outfile, const LZ78Options *opts, int threads,
+    uint32_t chunk_size, LZ78Stats *stats) {
+    memset(stats, 0, sizeof(LZ78Stats));
+    Pool *pool = pool_create(threads);
+    // a batch keeps every worker busy twice over
+    int batch_size = 2 * threads;
+    Chunk *chunks = calloc(batch_size, sizeof(Chunk));
+    // regular files are compressed in place, anything else is read into raw
+    Mapping map;
+    bool mapped = map_file(infile, &map);
+    size_t mapped_pos = 0;
+    uint8_t *raw = mapped ? NULL : malloc((size_t) batch_size * chunk_size);
+    if (!pool || !chunks || (!mapped && !raw)) {
+        pool_delete(pool);
+        free(chunks);
+        free(raw);
+        if (mapped) {
+            unmap_file(&map);
+        }
+        return LZ78_ERR_MEMORY;
+    }
+
+    // container header and chunk size
+    uint8_t head[HEADER_SIZE + 4];
+    FileHeader header = { 0 };
+    header.magic = MAGIC_CHUNKED;
+    header.protection = opts->protection;
+    header.bits = opts->bits;
+    write_header(head, &header);
+    store_le32(head + HEADER_SIZE, chunk_size);
+    LZ78Status status = fd_sink(&outfile, head, sizeof(head)) ? LZ78_OK : LZ78_ERR_SINK;
+    uint64_t offset = sizeof(head);
+
+    // index entries, grown as chunks are written
+    uint8_t *index = NULL;
+    uint32_t count = 0;
+    uint32_t index_cap = 0;
+
+    // frames carry the length of each chunk, their streams needn't repeat it,
+    // and the container's index already finds every chunk
+    LZ78Options chunk_opts = *opts;
+    chunk_opts.length = LZ78_UNKNOWN_LENGTH;
+    chunk_opts.index = false;
+    Batch batch = { chunks, &chunk_opts, infile, 0, NULL, 0, NULL };
+    bool eof = false;
+    while (status == LZ78_OK && !eof) {
+        // read in the next batch of chunks
+        uint64_t start = clock_ns();
+        int n = 0;
+        while (n < batch_size && !eof) {
+            Chunk *c = &chunks[n];
+            memset(c, 0, sizeof(Chunk));
+            if (mapped) {
+                c->raw = (uint8_t *) map.data + mapped_pos;
+                c->raw_len = map.len - mapped_pos < chunk_size ? map.len - mapped_pos : chunk_size;
+                mapped_pos += c->raw_len;
+                eof = mapped_pos == map.len;
+            } else {
+                c->raw = raw + (size_t) n * chunk_size;
+                c->raw_len = read_bytes(infile, c->raw, chunk_size);
+                eof = c->raw_len < chunk_size;
+            }
+            if (c->raw_len > 0) {
+                n += 1;
+            }
+        }
+        uint64_t read = clock_ns();
+        pool_run(pool, compress_chunk, &batch, n);
+        uint64_t codec = clock_ns();
+        stats->read_ns += read - start;
+        stats->codec_ns += codec - read;
+
+        // write out frames in order, noting them in the index
+        for (int i = 0; i < n; i += 1) {
+            Chunk *c = &chunks[i];
+            if (status == LZ78_OK) {
+                status = c->status;
+            }
+            if (status == LZ78_OK && count == index_cap) {
+                index_cap = index_cap ? index_cap * 2 : 64;
+                uint8_t *grown = realloc(index, (size_t) index_cap * ENTRY_SIZE);
+                if (grown) {
+                    index = grown;
+                } else {
+                    status = LZ78_ERR_MEMORY;
+                }
+            }
+            if (status == LZ78_OK) {
+                uint8_t frame[FRAME_SIZE];
+                store_le32(frame, c->raw_len);
+                store_le32(frame + 4, c->comp_len);
+                if (!fd_sink(&outfile, frame, FRAME_SIZE)
+                    || !fd_sink(&outfile, c->comp, c->comp_len)) {
+                    status = LZ78_ERR_SINK;
+                }
+                uint8_t *entry = index + (size_t) count * ENTRY_SIZE;
+                store_le64(entry, offset);
+                store_le32(entry + 8, c->comp_len);
+                store_le32(entry + 12, c->raw_len);
+                count += 1;
+                offset += FRAME_SIZE + c->comp_len;
+                lz78_stats_merge(stats, &c->stats);
+            }
+            free(c->comp);
+            c->comp = NULL;
+        }
+        stats->write_ns += clock_ns() - codec;
+    }
+
+    // end frame, index and footer
+    if (status == LZ78_OK) {
+        uint8_t tail[FRAME_SIZE + 4] = { 0 };
+        store_le32(tail + FRAME_SIZE, count);
+        uint64_t index_offset = offset + FRAME_SIZE;
+        uint8_t footer[FOOTER_SIZE];
+        store_le64(footer, index_offset);
+        store_le32(footer + 8, MAGIC_CHUNKED);
+        if (!fd_sink(&outfile, tail, sizeof(tail))
+            || (count && !fd_sink(&outfile, index, (size_t) count * ENTRY_SIZE))
+            || !fd_sink(&outfile, footer, FOOTER_SIZE)) {
+            status = LZ78_ERR_SINK;
+        }
+        offset += sizeof(tail) + (uint64_t) count * ENTRY_SIZE + FOOTER_SIZE;
+        stats->bits = offset * 8;
+    }
+
+    pool_delete(pool);
+    free(index);
+    free(chunks);
+    free(raw);
+    if (mapped) {
+        unmap_file(&map);
+    }
+    return status;
+}
+
+// read the index of a container that starts at base in a seekable infile
+// frames end where the index starts, *frames bytes past base
+static uint8_t *read_index(int infile, off_t base, uint32_t *count, uint64_t *frames) {
+    struct stat st;
+    if (fstat(infile, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size - base < FOOTER_SIZE) {
+        return NULL;
+    }
+    uint8_t footer[FOOTER_SIZE];
+    if (!pread_bytes(infile, footer, FOOTER_SIZE, st.st_size - FOOTER_SIZE)
+        || load_le32(footer + 8) != MAGIC_CHUNKED) {
+        return NULL;
+    }
+    uint64_t index_offset = load_le64(footer);
+    uint8_t n[4];
+    if (!pread_bytes(infile, n, 4, base + index_offset)) {
+        return NULL;
+    }
+    *count = load_le32(n);
+    *frames = index_offset;
+    uint64_t size = (uint64_t) *count * ENTRY_SIZE;
+    if (base + index_offset + 4 + size + FOOTER_SIZE != (uint64_t) st.st_size) {
+        return NULL;
+    }
+    uint8_t *index = malloc(size ? size : 1);
+    if (index && !pread_bytes(infile, index, size, base + index_offset + 4)) {
+        free(index);
+        return NULL;
+    }
+    return index;
+}
+
+// decompress a chunked container
+LZ78Status chunked_decode(int infile, int outfile, const uint8_t *head, int threads,
+    const LZ78Dict *dict, LZ78Stats *stats) {
+    memset(stats, 0, sizeof(LZ78Stats));
+    FileHeader header;
+    read_header(head, &header);
+    if (header.magic != MAGIC_CHUNKED) {
+        return LZ78_ERR_MAGIC;
+    }
+    uint8_t size[4];
+    if (read_bytes(infile, size, 4) != 4) {
+        return LZ78_ERR_TRUNCATED;
+    }
+    uint32_t chunk_size = load_le32(size);
+    if (chunk_size == 0 || chunk_size > MAX_CHUNK_SIZE) {
+        return LZ78_ERR_CORRUPT;
+    }
+
+    // seekable input goes through the index, anything else follows the frames
+    off_t base = lseek(infile, 0, SEEK_CUR) - HEADER_SIZE - 4;
+    uint32_t count = 0;
+    uint64_t frames = 0;
+    uint8_t *index = base >= 0 ? read_index(infile, base, &count, &frames) : NULL;
+    // the index adds up to the whole output, reserve room for it
+    // no chunk is bigger than the chunk size, whatever its entry says
+    if (index && outfile != -1) {
+        uint64_t length = 0;
+        for (uint32_t i = 0; i < count; i += 1) {
+            uint32_t raw_len = load_le32(index + (size_t) i * ENTRY_SIZE + 12);
+            length += raw_len < chunk_size ? raw_len : chunk_size;
+        }
+        preallocate(outfile, length);
+    }
+
+    Pool *pool = pool_create(threads);
+    int batch_size = 2 * threads;
+    Chunk *chunks = calloc(batch_size, sizeof(Chunk));
+    if (!pool || !chunks) {
+        pool_delete(pool);
+        free(chunks);
+        free(index);
+        return LZ78_ERR_MEMORY;
+    }
+    // with the index, chunks of a regular file are decompressed in place
+    Mapping map;
+    bool mapped = index && map_file(infile, &map);
+    Batch batch = { chunks, NULL, infile, base, NULL, 0, dict };
+    if (mapped) {
+        batch.map = map.base;
+        batch.map_size = map.size;
+    }
+    LZ78Status status = LZ78_OK;
+    uint64_t in_bytes = HEADER_SIZE + 4;
+    uint32_t next = 0;
+    bool end = false;
+    while (status == LZ78_OK && !end) {
+        // gather the next batch of chunks
+        uint64_t start = clock_ns();
+        int n = 0;
+        while (n < batch_size && !end && status == LZ78_OK) {
+            Chunk *c = &chunks[n];
+            memset(c, 0, sizeof(Chunk));
+            if (index) {
+                // the index says where each chunk is, workers read their own
+                if (next == count) {
+                    end = true;
+                    break;
+                }
+                uint8_t *entry = index + (size_t) next * ENTRY_SIZE;
+                c->offset = load_le64(entry);
+                c->comp_len = load_le32(entry + 8);
+                c->raw_len = load_le32(entry + 12);
+                // the index isn't trusted any more than the frames, chunks stay ahead of it
+                if (c->offset > frames || frames - c->offset < FRAME_SIZE
+                    || c->comp_len > frames - c->offset - FRAME_SIZE) {
+                    status = LZ78_ERR_CORRUPT;
+                    break;
+                }
+            } else {
+                // follow the frames
+                uint8_t frame[FRAME_SIZE];
+                if (read_bytes(infile, frame, FRAME_SIZE) != FRAME_SIZE) {
+                    status = LZ78_ERR_TRUNCATED;
+                    break;
+                }
+                c->raw_len = load_le32(frame);
+                c->comp_len = load_le32(frame + 4);
+                if (c->raw_len == 0 && c->comp_len == 0) {
+                    end = true;
+                    break;
+                }
+                if (c->raw_len > chunk_size) {
+                    status = LZ78_ERR_CORRUPT;
+                    break;
+                }
+                status = read_frame(infile, c);
+                if (status != LZ78_OK) {
+                    break;
+                }
+            }
+            if (c->raw_len > chunk_size) {
+                free(c->comp);
+                status = LZ78_ERR_CORRUPT;
+                break;
+            }
+            next += 1;
+            n += 1;
+        }
+        uint64_t read = clock_ns();
+        pool_run(pool, decompress_chunk, &batch, n);
+        uint64_t codec = clock_ns();
+        stats->read_ns += read - start;
+        stats->codec_ns += codec - read;
+
+        // write out chunks in order
+        for (int i = 0; i < n; i += 1) {
+            Chunk *c = &chunks[i];
+            if (status == LZ78_OK) {
+                status = c->status;
+            }
+            if (status == LZ78_OK && c->raw_len && outfile != -1
+                && !fd_sink(&outfile, c->raw, c->raw_len)) {
+                status = LZ78_ERR_SINK;
+            }
+            in_bytes += FRAME_SIZE + c->comp_len;
+            lz78_stats_merge(stats, &c->stats);
+            if (!c->mapped) {
+                free(c->comp);
+            }
+            free(c->raw);
+        }
+        stats->write_ns += clock_ns() - codec;
+    }
+    in_bytes += FRAME_SIZE + 4 + (uint64_t) next * ENTRY_SIZE + FOOTER_SIZE;
+    stats->bits = in_bytes * 8;
+
+    pool_delete(pool);
+    free(chunks);
+    free(index);
+    if (mapped) {
+        unmap_file(&map);
+    }
+    return status;
+}
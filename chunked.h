@@ -0,0 +1,52 @@
+#ifndef __CHUNKED_H__
+#define __CHUNKED_H__
+
+#include "lz78.h"
+#include <stdint.h>
+
+#define MAGIC_CHUNKED 0xBAADBAAD // Magic number of the chunked container.
+#define CHUNK_SIZE (1 << 20) // 1MB chunks by default.
+#define MAX_CHUNK_SIZE (1 << 28) // Keeps compressed chunks within 32 bits.
+#define FRAME_SIZE 8 // Bytes ahead of each chunk.
+#define ENTRY_SIZE 16 // Bytes per chunk in the index.
+#define FOOTER_SIZE 12 // Bytes of the footer.
+
+/*
+ * Chunked container, all fields little endian:
+ *
+ *   FileHeader      HEADER_SIZE bytes with magic MAGIC_CHUNKED
+ *   chunk size      4 bytes, uncompressed bytes per chunk
+ *   frames          for each chunk: 4 bytes uncompressed length,
+ *                   4 bytes compressed length, then the chunk as a complete
+ *                   LZ78 stream with its own dictionary
+ *   end frame       FRAME_SIZE zero bytes
+ *   index           4 bytes chunk count, then for each chunk: 8 bytes offset
+ *                   of its frame from the start of the container, 4 bytes
+ *                   compressed length, 4 bytes uncompressed length
+ *   footer          8 bytes offset of the index, 4 bytes MAGIC_CHUNKED
+ *
+ * Chunks can be compressed and decompressed independently of each other.
+ * Seekable input is decompressed through the index, anything else by
+ * following the frames.
+ */
+
+/*
+ * Compresses infile into a chunked container on outfile
+ * Chunks of chunk_size bytes are compressed on threads workers
+ * Fills stats with the totals over all chunks
+ */
+LZ78Status chunked_encode(int infile, int outfile, const LZ78Options *opts, int threads,
+    uint32_t chunk_size, LZ78Stats *stats);
+
+/*
+ * Decompresses the chunked container on infile to outfile
+ * head holds the HEADER_SIZE bytes already read from infile
+ * Chunks are decompressed on threads workers and written in order
+ * With outfile -1 chunks are only checked, nothing is written
+ * dict is used by chunks compressed with a pretrained dictionary, may be NULL
+ * Fills stats with the totals over all chunks
+ */
+LZ78Status chunked_decode(int infile, int outfile, const uint8_t *head, int threads,
+    const LZ78Dict *dict, LZ78Stats *stats);
+
+#endif
@@ -6,6 +6,16 @@
 #define STOP_CODE  0
 #define EMPTY_CODE 1
 #define START_CODE 2
-#define MAX_CODE   UINT16_MAX
+#define MIN_BITS     9 // Narrowest dictionary, codes up to 9 bits.
+#define MAX_BITS     24 // Widest dictionary, codes up to 24 bits.
+#define DEFAULT_BITS 16 // Dictionary used when none is chosen.
+
+// largest code of a dictionary with codes of the given bit width
+#define MAX_CODE(bits) ((UINT32_C(1) << (bits)) - 1)
+
+// bits needed to write x, 0 for 0
+static inline int get_bitlen(uint32_t x) {
+    return x ? 32 - __builtin_clz(x) : 0;
+}
 
 #endif
@@ -0,0 +1,137 @@
+#include "crc32c.h"
+#include "endian.h"
+
+#include <stdint.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define HAVE_SSE42 1
+#else
+#define HAVE_SSE42 0
+#endif
+
+#define POLY 0x82F63B78 // CRC32C polynomial, bit reversed.
+
+typedef uint32_t (*Crc)(uint32_t crc, const uint8_t *buf, size_t len);
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static uint32_t table[8][256]; // Slicing-by-8 tables for the software path.
+static Crc impl;
+
+// software CRC, eight bytes per step through the tables
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *buf, size_t len) {
+    crc = ~crc;
+    while (len >= 8) {
+        uint64_t word = load_le64(buf) ^ crc;
+        crc = table[7][word & 0xFF] ^ table[6][(word >> 8) & 0xFF]
+            ^ table[5][(word >> 16) & 0xFF] ^ table[4][(word >> 24) & 0xFF]
+            ^ table[3][(word >> 32) & 0xFF] ^ table[2][(word >> 40) & 0xFF]
+            ^ table[1][(word >> 48) & 0xFF] ^ table[0][word >> 56];
+        buf += 8;
+        len -= 8;
+    }
+    while (len > 0) {
+        crc = table[0][(crc ^ *buf) & 0xFF] ^ (crc >> 8);
+        buf += 1;
+        len -= 1;
+    }
+    return ~crc;
+}
+
+#if HAVE_SSE42
+// hardware CRC, the crc32 instruction takes eight bytes at a time
+__attribute__((target("sse4.2"))) static uint32_t crc32c_hw(
+    uint32_t crc, const uint8_t *buf, size_t len) {
+    uint64_t c = ~crc;
+    while (len >= 8) {
+        c = _mm_crc32_u64(c, load_le64(buf));
+        buf += 8;
+        len -= 8;
+    }
+    while (len > 0) {
+        c = _mm_crc32_u8((uint32_t) c, *buf);
+        buf += 1;
+        len -= 1;
+    }
+    return ~(uint32_t) c;
+}
+#endif
+
+// build the tables and pick the fastest implementation the CPU supports
+static void init(void) {
+    for (uint32_t i = 0; i < 256; i += 1) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit += 1) {
+            crc = crc & 1 ? (crc >> 1) ^ POLY : crc >> 1;
+        }
+        table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i += 1) {
+        for (int t = 1; t < 8; t += 1) {
+            table[t][i] = table[0][table[t - 1][i] & 0xFF] ^ (table[t - 1][i] >> 8);
+        }
+    }
+    impl = crc32c_sw;
+#if HAVE_SSE42
+    if (__builtin_cpu_supports("sse4.2")) {
+        impl = crc32c_hw;
+    }
+#endif
+}
+
+// extend a CRC32C over buf
+uint32_t crc32c(uint32_t crc, const uint8_t *buf, size_t len) {
+    pthread_once(&once, init);
+    return impl(crc, buf, len);
+}
+
+// the 32x32 GF(2) matrix mat times vec, a column per bit of vec
+static uint32_t gf2_times(const uint32_t *mat, uint32_t vec) {
+    uint32_t sum = 0;
+    while (vec) {
+        sum ^= vec & 1 ? *mat : 0;
+        vec >>= 1;
+        mat += 1;
+    }
+    return sum;
+}
+
+// square the GF(2) matrix mat, the operator for twice as many zero bits
+static void gf2_square(uint32_t *square, const uint32_t *mat) {
+    for (int n = 0; n < 32; n += 1) {
+        square[n] = gf2_times(mat, mat[n]);
+    }
+}
+
+// CRC of two pieces from theirs, the first's shifted over len2 zero bytes
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t len2) {
+    if (len2 == 0) {
+        return crc1;
+    }
+    // operator for one zero bit, then squared to two and four
+    uint32_t even[32], odd[32];
+    odd[0] = POLY;
+    for (int n = 1; n < 32; n += 1) {
+        odd[n] = 1u << (n - 1);
+    }
+    gf2_square(even, odd);
+    gf2_square(odd, even);
+    // apply the operators for each set bit of len2, a byte being eight zero bits
+    do {
+        gf2_square(even, odd);
+        if (len2 & 1) {
+            crc1 = gf2_times(even, crc1);
+        }
+        len2 >>= 1;
+        if (len2 == 0) {
+            break;
+        }
+        gf2_square(odd, even);
+        if (len2 & 1) {
+            crc1 = gf2_times(odd, crc1);
+        }
+        len2 >>= 1;
+    } while (len2);
+    return crc1 ^ crc2;
+}
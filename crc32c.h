@@ -0,0 +1,20 @@
+#ifndef __CRC32C_H__
+#define __CRC32C_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Extends the CRC32C (Castagnoli) crc of earlier input over buf[0..len)
+ * Start from 0, crc32c(crc32c(0, a), b) is the CRC of a followed by b
+ * Uses the SSE4.2 crc32 instruction when the CPU has it, tables otherwise
+ */
+uint32_t crc32c(uint32_t crc, const uint8_t *buf, size_t len);
+
+/*
+ * Returns the CRC32C of a followed by b from crc1 = crc32c(0, a),
+ * crc2 = crc32c(0, b) and len2 the length of b, for pieces checked apart
+ */
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+
+#endif
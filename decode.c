@@ -1,24 +1,142 @@
-#include "word.h"
+#include "lz78.h"
+#include "batch.h"
+#include "chunked.h"
 #include "code.h"
 #include "io.h"
+#include "pipeline.h"
+#include "pool.h"
+#include "report.h"
+#include "seek.h"
 
 #include <stdio.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 
-#define OPTIONS "hvi:o:"
+#define OPTIONS "hvjcmd:t:p:s:l:i:o:"
 
-// gets bit length by repeatedly shifting right till 0
-static int get_bitlen(uint16_t x) {
-    int bit_len = 0;
-    while (x != 0) {
-        x >>= 1;
-        bit_len += 1;
+// decompress a single stream from infile to outfile, head holds its first head_len bytes
+// with a ring depth, reading and writing run on threads of their own
+static LZ78Status decode_stream(int infile, int outfile, uint8_t *head, int head_len, int depth,
+    const LZ78Dict *dict, LZ78Stats *stats) {
+    uint64_t start = clock_ns();
+    uint64_t read_ns = 0;
+    Pipeline *pipe = NULL;
+    if (depth) {
+        pipe = pipeline_create(infile, outfile, depth);
+        if (!pipe) {
+            return LZ78_ERR_MEMORY;
+        }
+    }
+    // decoder reads the header and pairs and writes words to outfile, timing the writes
+    // without an outfile the words are only checked
+    TimedSink out = { outfile == -1 ? null_sink : fd_sink, &outfile, 0 };
+    if (pipe) {
+        out.sink = pipeline_sink;
+        out.ctx = pipe;
+    }
+    LZ78Decoder *dec = lz78_decoder_create(timed_sink, &out);
+    if (!dec) {
+        if (pipe) {
+            pipeline_finish(pipe);
+        }
+        return LZ78_ERR_MEMORY;
+    }
+    lz78_decoder_use_dict(dec, dict);
+
+    // the header comes first, already read in
+    LZ78Status status = lz78_decoder_update(dec, head, head_len);
+    // make permission for outfile match protection bits in fileheader
+    // and reserve room for all of the output if the header says how much
+    const FileHeader *header = lz78_decoder_header(dec);
+    if (status == LZ78_OK && header && outfile != -1) {
+        fchmod(outfile, header->protection);
+        // only as much as the rest of the input can come to, the length isn't checked yet
+        uint64_t left = file_left(infile);
+        if (header->flags & FLAG_SIZE && left != UINT64_MAX) {
+            uint64_t bound = lz78_max_length(header, left + head_len);
+            preallocate(outfile, header->length < bound ? header->length : bound);
+        }
     }
-    return bit_len;
+
+    Mapping map;
+    uint64_t t = clock_ns();
+    if (pipe) {
+        // decompress blocks as the reader thread hands them over
+        const uint8_t *block = NULL;
+        size_t len = 0;
+        while (status == LZ78_OK && (len = pipeline_next(pipe, &block)) > 0) {
+            read_ns += clock_ns() - t;
+            status = lz78_decoder_update(dec, block, len);
+            t = clock_ns();
+        }
+        read_ns += clock_ns() - t;
+    } else if (status == LZ78_OK && map_file(infile, &map)) {
+        // regular file, decompress the rest of it in place
+        read_ns += clock_ns() - t;
+        status = lz78_decoder_update(dec, map.data, map.len);
+        unmap_file(&map);
+    } else {
+        // while there is input left, decompress it a block at a time
+        uint8_t block[BLOCK];
+        int bytes_read = 0;
+        while (status == LZ78_OK && (bytes_read = read_bytes(infile, block, BLOCK)) > 0) {
+            read_ns += clock_ns() - t;
+            status = lz78_decoder_update(dec, block, bytes_read);
+            t = clock_ns();
+        }
+        read_ns += clock_ns() - t;
+    }
+    // flush buffered words and check the stream was complete
+    if (status == LZ78_OK) {
+        status = lz78_decoder_finish(dec);
+    }
+    lz78_decoder_stats(dec, stats);
+    lz78_decoder_delete(dec);
+    // wait for the writer thread to drain the output
+    t = clock_ns();
+    if (pipe && !pipeline_finish(pipe) && status == LZ78_OK) {
+        status = LZ78_ERR_SINK;
+    }
+    stats->read_ns = read_ns;
+    stats->write_ns = out.ns + (clock_ns() - t);
+    stats->codec_ns = clock_ns() - start - stats->read_ns - stats->write_ns;
+    return status;
+}
+
+// decompress the files named in names, or on stdin if count is 0, each to a file of its own
+static LZ78Status decode_many(char **names, int count, const LZ78Dict *dict, bool check,
+    int threads, LZ78Stats *stats) {
+    BatchFile *files = NULL;
+    if (!batch_list(names, count, &files, &count)) {
+        fprintf(stderr, "Couldn't list the files to decompress.\n");
+        return LZ78_ERR_MEMORY;
+    }
+    LZ78Status status = batch_decode(files, count, dict, check, threads, stats);
+    for (int i = 0; i < count; i += 1) {
+        if (files[i].status != LZ78_OK) {
+            fprintf(stderr, "%s: %s.\n", files[i].path,
+                files[i].err ? strerror(files[i].err) : lz78_strerror(files[i].status));
+        }
+    }
+    batch_free(files, count);
+    return status;
+}
+
+// parse a byte offset or count, false if it isn't one
+static bool parse_bytes(const char *arg, uint64_t *bytes) {
+    char *end = NULL;
+    errno = 0;
+    unsigned long long value = strtoull(arg, &end, 10);
+    if (errno || end == arg || *end != '\0' || arg[0] == '-') {
+        return false;
+    }
+    *bytes = value;
+    return true;
 }
 
 int main(int argc, char **argv) {
@@ -26,6 +144,17 @@ int main(int argc, char **argv) {
     int infile = 0;
     int outfile = 1;
     bool verbose = false;
+    bool json = false;
+    bool check = false;
+    bool many = false;
+    char *output = NULL;
+    int threads = pool_cpus();
+    int depth = 0;
+    bool ranged = false;
+    uint64_t offset = 0;
+    uint64_t length = LZ78_UNKNOWN_LENGTH;
+    LZ78Dict *dict = NULL;
+    int dictfile = -1;
 
     int opt = 0;
     while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
@@ -36,15 +165,62 @@ int main(int argc, char **argv) {
                 "   Decompresses files with the LZ78 decompression algorithm.\n"
                 "   Used with files compressed with the corresponding encoder.\n\n"
                 "USAGE\n"
-                "   ./decode [-vh] [-i input] [-o output]\n\n"
+                "   ./decode [-vjch] [-d dict] [-t threads] [-p depth] [-s offset] [-l length]\n"
+                "            [-i input] [-o output]\n"
+                "   ./decode -m [-vjch] [-d dict] [-t threads] [file.lz...]\n\n"
 
                 "OPTIONS\n"
                 "   -v          Display decompression statistics\n"
+                "   -j          Print all decompression statistics as JSON on stderr\n"
+                "   -c          Check the input decompresses and matches its checksum, no output\n"
+                "   -m          Decompress each file.lz named after the options, or on stdin, to\n"
+                "               file\n"
+                "   -d dict     Dictionary the input was compressed with\n"
+                "   -t threads  Workers for chunked or indexed input, or -m (one per CPU by\n"
+                "               default)\n"
+                "   -p depth    Read and write on their own threads through rings of depth blocks\n"
+                "               (single streams only, not with -m, -s or -l)\n"
+                "   -s offset   Only output from byte offset of the decompressed input on\n"
+                "   -l length   Only output up to length bytes (all the rest by default)\n"
                 "   -i input    Specify input to decompress (stdin by default)\n"
                 "   -o output   Specify output of decompressed input (stdout by default)\n"
                 "   -h          Display program usage\n");
             return 0;
         case 'v': verbose = true; break;
+        case 'j': json = true; break;
+        case 'c': check = true; break;
+        case 'm': many = true; break;
+        case 'd':
+            dictfile = open(optarg, O_RDONLY);
+            dict = dictfile == -1 ? NULL : lz78_dict_read(dictfile);
+            if (!dict) {
+                fprintf(stderr, "Couldn't load dictionary %s.\n", optarg);
+                exit(1);
+            }
+            close(dictfile);
+            break;
+        case 't':
+            threads = atoi(optarg);
+            if (threads < 1) {
+                fprintf(stderr, "Thread count must be at least 1.\n");
+                exit(1);
+            }
+            break;
+        case 'p':
+            depth = atoi(optarg);
+            if (depth < 2) {
+                fprintf(stderr, "Ring depth must be at least 2 blocks.\n");
+                exit(1);
+            }
+            break;
+        case 's':
+        case 'l':
+            if (!parse_bytes(optarg, opt == 's' ? &offset : &length)) {
+                fprintf(stderr, "Range %s must be a number of bytes.\n", optarg);
+                exit(1);
+            }
+            ranged = true;
+            break;
         case 'i':
             infile = open(optarg, O_RDONLY);
             if (infile == -1) {
@@ -53,23 +229,29 @@ int main(int argc, char **argv) {
                 exit(1);
             }
             break;
-        case 'o':
-            outfile = open(optarg, O_WRONLY | O_CREAT | O_TRUNC);
-            if (outfile == -1) {
-                close(outfile);
-                perror("Couldn't open output file!\n");
-                exit(1);
-            }
-            break;
+        case 'o': output = optarg; break;
         default:
             fprintf(stderr,
                 "SYNOPSIS\n"
                 "   Decompresses files with the LZ78 decompression algorithm.\n"
                 "   Used with files compressed with the corresponding encoder.\n\n"
                 "USAGE\n"
-                "   ./decode [-vh] [-i input] [-o output]\n\n"
+                "   ./decode [-vjch] [-d dict] [-t threads] [-p depth] [-s offset] [-l length]\n"
+                "            [-i input] [-o output]\n"
+                "   ./decode -m [-vjch] [-d dict] [-t threads] [file.lz...]\n\n"
                 "OPTIONS\n"
                 "   -v          Display decompression statistics\n"
+                "   -j          Print all decompression statistics as JSON on stderr\n"
+                "   -c          Check the input decompresses and matches its checksum, no output\n"
+                "   -m          Decompress each file.lz named after the options, or on stdin, to\n"
+                "               file\n"
+                "   -d dict     Dictionary the input was compressed with\n"
+                "   -t threads  Workers for chunked or indexed input, or -m (one per CPU by\n"
+                "               default)\n"
+                "   -p depth    Read and write on their own threads through rings of depth blocks\n"
+                "               (single streams only, not with -m, -s or -l)\n"
+                "   -s offset   Only output from byte offset of the decompressed input on\n"
+                "   -l length   Only output up to length bytes (all the rest by default)\n"
                 "   -i input    Specify input to decompress (stdin by default)\n"
                 "   -o output   Specify output of decompressed input (stdout by default)\n"
                 "   -h          Display program usage\n");
@@ -77,70 +259,130 @@ int main(int argc, char **argv) {
         }
     }
 
-    // file stats
-    struct stat FileData;
-    fstat(infile, &FileData);
-
-    // read in file header
-    FileHeader header;
-    read_header(infile, &header);
-
-    // verify magic number
-    if (!(header.magic == MAGIC)) {
-        close(infile);
-        close(outfile);
-        perror("Magic number does not match. Cannot continue with decompression.\n");
+    if (ranged && many) {
+        fprintf(stderr, "Ranges are for a single input, not -m.\n");
+        exit(1);
+    }
+    if (depth && (ranged || many)) {
+        fprintf(stderr, "Rings are for a single stream, -p can't go with -m, -s or -l.\n");
         exit(1);
     }
 
-    // make permission for outfile match protection bits in fileheader
-    fchmod(outfile, header.protection);
-
-    // create a new word table
-    WordTable *table = wt_create();
-    uint16_t curr_code = 0;
-    uint16_t next_code = START_CODE;
-    uint8_t curr_sym = 0;
-
-    // while there are pairs left to read
-    while (read_pair(infile, &curr_code, &curr_sym, get_bitlen(next_code))) {
-        //printf("curr code = %u, curr sym = %u, next code = %u\n", curr_code, curr_sym, next_code);
-        // append read symbol to word noted by curr code and add result to table
-        table[next_code] = word_append_sym(table[curr_code], curr_sym);
-        // write word constructed above to outfile
-        write_word(outfile, table[next_code]);
-        // increment next code
-        next_code += 1;
-        // if we've reached max code, reset the wt
-        if (next_code == MAX_CODE) {
-            wt_reset(table);
-            next_code = START_CODE;
+    // a check writes nothing, so the output isn't touched, let alone truncated
+    if (check) {
+        outfile = -1;
+        depth = 0;
+    } else if (output && !many) {
+        outfile = open(output, O_WRONLY | O_CREAT | O_TRUNC);
+        if (outfile == -1) {
+            close(outfile);
+            perror("Couldn't open output file!\n");
+            exit(1);
         }
     }
 
-    // flush buffered words
-    flush_words(outfile);
+    uint64_t start = clock_ns();
+    LZ78Stats stats = { 0 };
+    LZ78Status status = LZ78_OK;
+    bool chunked = false;
+    bool indexed = false;
+    if (many) {
+        // every file gets its own output and protection bits from its header
+        status = decode_many(argv + optind, argc - optind, dict, check, threads, &stats);
+    } else {
+        // file stats
+        struct stat FileData;
+        fstat(infile, &FileData);
 
-    // delete wt
-    wt_delete(table);
+        // read in the header to tell a chunked container from a single stream
+        uint8_t head[HEADER_MAX];
+        int head_len = read_bytes(infile, head, HEADER_SIZE);
+        FileHeader header;
+        read_header(head, &header);
+        chunked = head_len == HEADER_SIZE && header.magic == MAGIC_CHUNKED;
+        // a stream's flags say how much more header there is, read it in too
+        if (head_len == HEADER_SIZE && header.magic == MAGIC) {
+            int rest = header_size(header.flags) - HEADER_SIZE;
+            head_len += read_bytes(infile, head + HEADER_SIZE, rest);
+        }
+        if (chunked) {
+            // make permission for outfile match protection bits in fileheader
+            if (outfile != -1) {
+                fchmod(outfile, header.protection);
+            }
+            // decompress chunks in parallel, -t workers read and write for themselves
+            if (depth) {
+                fprintf(stderr, "Chunked input is decoded by -t workers, -p is ignored.\n");
+            }
+            status = chunked_decode(infile, outfile, head, threads, dict, &stats);
+        } else {
+            // a regular file can be read anywhere: streams with a seek index
+            // decompress a segment between resets per worker, ranges skip
+            // ahead to the reset before them
+            Mapping map;
+            bool mapped = head_len == header_size(header.flags) && (ranged || !depth)
+                          && map_file(infile, &map);
+            const uint8_t *stream = mapped ? map.data - head_len : NULL;
+            size_t stream_len = mapped ? map.len + head_len : 0;
+            if (mapped && (ranged || seek_indexed(stream, stream_len))) {
+                indexed = seek_indexed(stream, stream_len);
+                if (outfile != -1) {
+                    fchmod(outfile, header.protection);
+                }
+                status = seek_decode(
+                    stream, stream_len, outfile, offset, length, threads, dict, &stats);
+            } else if (ranged) {
+                fprintf(stderr, "Ranges need the input to be a regular file.\n");
+                exit(1);
+            } else {
+                status = decode_stream(infile, outfile, head, head_len, depth, dict, &stats);
+            }
+            if (mapped) {
+                unmap_file(&map);
+            }
+        }
+    }
 
-    // close files
+    // close files, output that failed keeps no disk reserved past what it got
     close(infile);
-    close(outfile);
+    if (outfile != -1) {
+        if (status != LZ78_OK) {
+            release_preallocated(outfile);
+        }
+        close(outfile);
+    }
+    uint64_t wall_ns = clock_ns() - start;
+    lz78_dict_delete(dict);
+
+    if (status != LZ78_OK && many) {
+        // files of a batch have said what went wrong with them
+        exit(1);
+    } else if (status == LZ78_ERR_MAGIC) {
+        fprintf(stderr, "Magic number does not match. Cannot continue with decompression.\n");
+        exit(1);
+    } else if (status != LZ78_OK) {
+        fprintf(stderr, "%s.\n", lz78_strerror(status));
+        exit(1);
+    }
 
     // check for printing decompression stats
     if (verbose) {
         // convert compressed total bits to bytes
         uint64_t bytes = 0;
-        if (total_bits % 8 == 0) {
-            bytes = total_bits / 8;
+        if (stats.bits % 8 == 0) {
+            bytes = stats.bits / 8;
         } else {
-            bytes = (total_bits / 8) + 1;
+            bytes = (stats.bits / 8) + 1;
         }
         fprintf(stderr, "Compressed file size: %" PRId64 " bytes\n", bytes);
-        fprintf(stderr, "Uncompressed file size: %" PRId64 " bytes\n", total_syms);
-        float space_saving = (100.0 * (1.0 - ((float) bytes / total_syms)));
+        fprintf(stderr, "Uncompressed file size: %" PRId64 " bytes\n", stats.syms);
+        float space_saving = (100.0 * (1.0 - ((float) bytes / stats.syms)));
         fprintf(stderr, "Space saving: %.2f%%\n", space_saving);
+        report_text(stderr, &stats, wall_ns);
+    }
+    if (json) {
+        const char *mode = many ? "batch" : chunked ? "chunked" : indexed ? "indexed" : "stream";
+        report_json(stderr, "decode", mode, &stats, wall_ns);
     }
     return 0;
 }
@@ -1,24 +1,112 @@
-#include "trie.h"
+#include "lz78.h"
+#include "batch.h"
+#include "chunked.h"
 #include "code.h"
 #include "io.h"
+#include "pipeline.h"
+#include "pool.h"
+#include "report.h"
 
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 
-#define OPTIONS "hvi:o:"
+#define OPTIONS "hvjnwxzumb:l:r:d:e:t:c:p:i:o:"
 
-// gets bit length by repeatedly shifting right till 0
-static int get_bitlen(uint16_t x) {
-    int bit_len = 0;
-    while (x != 0) {
-        x >>= 1;
-        bit_len += 1;
-    }
-    return bit_len;
+// compress infile to outfile as a single stream
+// with a ring depth, reading and writing run on threads of their own
+static LZ78Status encode_stream(
+    int infile, int outfile, LZ78Options *opts, int depth, LZ78Stats *stats) {
+    uint64_t start = clock_ns();
+    uint64_t read_ns = 0;
+    Pipeline *pipe = NULL;
+    if (depth) {
+        pipe = pipeline_create(infile, outfile, depth);
+        if (!pipe) {
+            return LZ78_ERR_MEMORY;
+        }
+    }
+    // encoder writes the header and pairs to outfile, timing the writes
+    TimedSink out = { fd_sink, &outfile, 0 };
+    if (pipe) {
+        out.sink = pipeline_sink;
+        out.ctx = pipe;
+    }
+    LZ78Encoder *enc = lz78_encoder_create(opts, timed_sink, &out);
+    if (!enc) {
+        if (pipe) {
+            pipeline_finish(pipe);
+        }
+        return LZ78_ERR_MEMORY;
+    }
+
+    LZ78Status status = LZ78_OK;
+    Mapping map;
+    uint64_t t = clock_ns();
+    if (pipe) {
+        // compress blocks as the reader thread hands them over
+        const uint8_t *block = NULL;
+        size_t len = 0;
+        while (status == LZ78_OK && (len = pipeline_next(pipe, &block)) > 0) {
+            read_ns += clock_ns() - t;
+            status = lz78_encoder_update(enc, block, len);
+            t = clock_ns();
+        }
+        read_ns += clock_ns() - t;
+    } else if (map_file(infile, &map)) {
+        // regular file, compress it in place
+        read_ns += clock_ns() - t;
+        status = lz78_encoder_update(enc, map.data, map.len);
+        unmap_file(&map);
+    } else {
+        // while there are syms left to read, compress them a block at a time
+        uint8_t block[BLOCK];
+        int bytes_read = 0;
+        while (status == LZ78_OK && (bytes_read = read_bytes(infile, block, BLOCK)) > 0) {
+            read_ns += clock_ns() - t;
+            status = lz78_encoder_update(enc, block, bytes_read);
+            t = clock_ns();
+        }
+        read_ns += clock_ns() - t;
+    }
+    // write the last pair and STOP_CODE and flush
+    if (status == LZ78_OK) {
+        status = lz78_encoder_finish(enc);
+    }
+    lz78_encoder_stats(enc, stats);
+    lz78_encoder_delete(enc);
+    // wait for the writer thread to drain the output
+    t = clock_ns();
+    if (pipe && !pipeline_finish(pipe) && status == LZ78_OK) {
+        status = LZ78_ERR_SINK;
+    }
+    stats->read_ns = read_ns;
+    stats->write_ns = out.ns + (clock_ns() - t);
+    stats->codec_ns = clock_ns() - start - stats->read_ns - stats->write_ns;
+    return status;
+}
+
+// compress the files named in names, or on stdin if count is 0, each to a file of its own
+static LZ78Status encode_many(
+    char **names, int count, LZ78Options *opts, int threads, LZ78Stats *stats) {
+    BatchFile *files = NULL;
+    if (!batch_list(names, count, &files, &count)) {
+        fprintf(stderr, "Couldn't list the files to compress.\n");
+        return LZ78_ERR_MEMORY;
+    }
+    LZ78Status status = batch_encode(files, count, opts, threads, stats);
+    for (int i = 0; i < count; i += 1) {
+        if (files[i].status != LZ78_OK) {
+            fprintf(stderr, "%s: %s.\n", files[i].path,
+                files[i].err ? strerror(files[i].err) : lz78_strerror(files[i].status));
+        }
+    }
+    batch_free(files, count);
+    return status;
 }
 
 int main(int argc, char **argv) {
@@ -26,6 +114,23 @@ int main(int argc, char **argv) {
     int infile = 0;
     int outfile = 1;
     bool verbose = false;
+    bool json = false;
+    bool checksum = true;
+    bool many = false;
+    bool lzw = false;
+    bool indexed = false;
+    bool entropy = false;
+    bool stored = true;
+    int bits = DEFAULT_BITS;
+    int level = LZ78_DEFAULT_LEVEL;
+    LZ78Policy policy = LZ78_RESET;
+    LZ78Engine engine = LZ78_DEFAULT_ENGINE;
+    LZ78Dict *dict = NULL;
+    int dictfile = -1;
+    int threads = 0;
+    uint32_t chunk_size = CHUNK_SIZE;
+    int depth = 0;
+    char *unit = NULL;
 
     int opt = 0;
     while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
@@ -36,14 +141,119 @@ int main(int argc, char **argv) {
                 "   Compresses files using the LZ78 compression algorithm.\n"
                 "   Compressed files are decompressed with the corresponding decoder.\n\n"
                 "USAGE\n"
-                "   ./encode [-vh] [-i input] [-o output]\n\n"
+                "   ./encode [-vjnwxzuh] [-b bits] [-l level] [-r policy] [-d dict] [-e engine]\n"
+                "            [-t threads] [-c chunk] [-p depth] [-i input] [-o output]\n"
+                "   ./encode -m [-vjnwxzuh] [-b bits] [-l level] [-r policy] [-d dict]\n"
+                "            [-e engine] [-t threads] [file...]\n\n"
                 "OPTIONS\n"
                 "   -v          Display compression statistics\n"
+                "   -j          Print all compression statistics as JSON on stderr\n"
+                "   -n          Leave out the CRC32C checksum of the input\n"
+                "   -w          Send codes only, LZW style, without symbols (not with -d)\n"
+                "   -x          End the stream with a seek index of its dictionary resets, for\n"
+                "               decode -s and -l and parallel decoding (not with -t)\n"
+                "   -z          Huffman code the pairs a block at a time, smaller and a little\n"
+                "               slower to decode\n"
+                "   -u          Code every block, never store one that doesn't compress as it is\n"
+                "   -m          Compress each file named after the options, or on stdin, to\n"
+                "               file.lz\n"
+                "   -b bits     Dictionary code width, 9-24 bits (16 by default)\n"
+                "   -l level    Parsing effort 1-4, higher is slower and smaller (1 by default),\n"
+                "               above 1 only with -r freeze or adaptive and not with -w\n"
+                "   -r policy   When the dictionary fills: reset (default), freeze or adaptive\n"
+                "   -d dict     Start from a dictionary trained with lztrain\n"
+                "   -e engine   Dictionary engine: trie (default) or hash, output is the same\n"
+                "   -t threads  Compress independent chunks, or with -m files, on threads workers\n"
+                "   -c chunk    Chunk size for -t, with optional K or M suffix (1M by default)\n"
+                "   -p depth    Read and write on their own threads through rings of depth blocks\n"
+                "               (not with -t or -m)\n"
                 "   -i input    Specify input to compress (stdin by default)\n"
                 "   -o output   Specify output of compressed input (stdout by default)\n"
                 "   -h          Display program help and usage\n");
             return 0;
         case 'v': verbose = true; break;
+        case 'j': json = true; break;
+        case 'n': checksum = false; break;
+        case 'w': lzw = true; break;
+        case 'x': indexed = true; break;
+        case 'z': entropy = true; break;
+        case 'u': stored = false; break;
+        case 'm': many = true; break;
+        case 'b':
+            bits = atoi(optarg);
+            if (bits < MIN_BITS || bits > MAX_BITS) {
+                fprintf(stderr, "Dictionary code width must be %d-%d bits.\n", MIN_BITS, MAX_BITS);
+                exit(1);
+            }
+            break;
+        case 'l':
+            level = atoi(optarg);
+            if (level < LZ78_MIN_LEVEL || level > LZ78_MAX_LEVEL) {
+                fprintf(stderr, "Level must be %d-%d.\n", LZ78_MIN_LEVEL, LZ78_MAX_LEVEL);
+                exit(1);
+            }
+            break;
+        case 'r':
+            if (strcmp(optarg, "reset") == 0) {
+                policy = LZ78_RESET;
+            } else if (strcmp(optarg, "freeze") == 0) {
+                policy = LZ78_FREEZE;
+            } else if (strcmp(optarg, "adaptive") == 0) {
+                policy = LZ78_ADAPTIVE;
+            } else {
+                fprintf(stderr, "Dictionary policy must be reset, freeze or adaptive.\n");
+                exit(1);
+            }
+            break;
+        case 'd':
+            dictfile = open(optarg, O_RDONLY);
+            dict = dictfile == -1 ? NULL : lz78_dict_read(dictfile);
+            if (!dict) {
+                fprintf(stderr, "Couldn't load dictionary %s.\n", optarg);
+                exit(1);
+            }
+            close(dictfile);
+            break;
+        case 'e':
+            if (strcmp(optarg, "trie") == 0) {
+                engine = LZ78_TRIE;
+            } else if (strcmp(optarg, "hash") == 0) {
+                engine = LZ78_HASH;
+            } else {
+                fprintf(stderr, "Dictionary engine must be trie or hash.\n");
+                exit(1);
+            }
+            break;
+        case 't':
+            threads = atoi(optarg);
+            if (threads < 1) {
+                fprintf(stderr, "Thread count must be at least 1.\n");
+                exit(1);
+            }
+            break;
+        case 'c':
+            chunk_size = strtoul(optarg, &unit, 10);
+            if (*unit == 'K' || *unit == 'k') {
+                chunk_size <<= 10;
+            } else if (*unit == 'M' || *unit == 'm') {
+                chunk_size <<= 20;
+            }
+            if (chunk_size == 0 || chunk_size > MAX_CHUNK_SIZE) {
+                fprintf(stderr, "Chunk size must be 1 byte to %dM.\n", MAX_CHUNK_SIZE >> 20);
+                exit(1);
+            }
+            // chunks imply the chunked container
+            if (!threads) {
+                threads = pool_cpus();
+            }
+            break;
+        case 'p':
+            depth = atoi(optarg);
+            if (depth < 2) {
+                fprintf(stderr, "Ring depth must be at least 2 blocks.\n");
+                exit(1);
+            }
+            break;
         case 'i':
             infile = open(optarg, O_RDONLY);
             if (infile == -1) {
@@ -66,9 +276,32 @@ int main(int argc, char **argv) {
                 "   Compresses files using the LZ78 compression algorithm.\n"
                 "   Compressed files are decompressed with the corresponding decoder.\n\n"
                 "USAGE\n"
-                "   ./encode [-vh] [-i input] [-o output]\n\n"
+                "   ./encode [-vjnwxzuh] [-b bits] [-l level] [-r policy] [-d dict] [-e engine]\n"
+                "            [-t threads] [-c chunk] [-p depth] [-i input] [-o output]\n"
+                "   ./encode -m [-vjnwxzuh] [-b bits] [-l level] [-r policy] [-d dict]\n"
+                "            [-e engine] [-t threads] [file...]\n\n"
                 "OPTIONS\n"
                 "   -v          Display compression statistics\n"
+                "   -j          Print all compression statistics as JSON on stderr\n"
+                "   -n          Leave out the CRC32C checksum of the input\n"
+                "   -w          Send codes only, LZW style, without symbols (not with -d)\n"
+                "   -x          End the stream with a seek index of its dictionary resets, for\n"
+                "               decode -s and -l and parallel decoding (not with -t)\n"
+                "   -z          Huffman code the pairs a block at a time, smaller and a little\n"
+                "               slower to decode\n"
+                "   -u          Code every block, never store one that doesn't compress as it is\n"
+                "   -m          Compress each file named after the options, or on stdin, to\n"
+                "               file.lz\n"
+                "   -b bits     Dictionary code width, 9-24 bits (16 by default)\n"
+                "   -l level    Parsing effort 1-4, higher is slower and smaller (1 by default),\n"
+                "               above 1 only with -r freeze or adaptive and not with -w\n"
+                "   -r policy   When the dictionary fills: reset (default), freeze or adaptive\n"
+                "   -d dict     Start from a dictionary trained with lztrain\n"
+                "   -e engine   Dictionary engine: trie (default) or hash, output is the same\n"
+                "   -t threads  Compress independent chunks, or with -m files, on threads workers\n"
+                "   -c chunk    Chunk size for -t, with optional K or M suffix (1M by default)\n"
+                "   -p depth    Read and write on their own threads through rings of depth blocks\n"
+                "               (not with -t or -m)\n"
                 "   -i input    Specify input to compress (stdin by default)\n"
                 "   -o output   Specify output of compressed input (stdout by default)\n"
                 "   -h          Display program help and usage\n");
@@ -78,94 +311,102 @@ int main(int argc, char **argv) {
     // find file size and protection bit mask of infile
     struct stat FileData;
     fstat(infile, &FileData);
-    //off_t filesize = FileData.st_size;
     mode_t prot = FileData.st_mode;
+    // what's left of a regular file is the length the header records
+    off_t offset = lseek(infile, 0, SEEK_CUR);
+    bool sized = S_ISREG(FileData.st_mode) && offset >= 0 && offset <= FileData.st_size;
 
-    // init header with prot bits
-    FileHeader header = { 0 };
-    header.magic = MAGIC;
-    header.protection = prot;
-
-    // make permission for outfile match protection bits in fileheader
-    fchmod(outfile, header.protection);
-
-    //write out file header to outfile
-    write_header(outfile, &header);
-
-    // trie stuff
-    TrieNode *root = trie_create();
-    TrieNode *curr_node = root;
-    TrieNode *prev_node = NULL;
-    uint16_t next_code = START_CODE;
-    uint8_t prev_sym = 0;
-    uint8_t curr_sym = 0;
-
-    // while there are syms left to read
-    while (read_sym(infile, &curr_sym)) {
-        // set next node
-        TrieNode *next_node = trie_step(curr_node, curr_sym);
-        // we have seen the current prefix
-        if (next_node) {
-            // move on to next node
-            prev_node = curr_node;
-            curr_node = next_node;
-        } else {
-            // new prefix, write out pair with code of bit length next_code
-            //printf("curr_node->code = %u, prev_sym = %u\n", curr_node->code, prev_sym);
-            write_pair(outfile, curr_node->code, curr_sym, get_bitlen(next_code));
-            // create new child node
-            curr_node->children[curr_sym] = trie_node_create(next_code);
-            // point back to root
-            curr_node = root;
-            // inc next available code
-            next_code += 1;
-        }
-        // if we're at MAX_CODE
-        if (next_code == MAX_CODE) {
-            // reached MAX_CODE, reset code
-            next_code = START_CODE;
-            // reset trie to just root
-            trie_reset(root);
-            // curr node should point back to root
-            curr_node = root;
-        }
-        // update prev sym as the curr sym
-        prev_sym = curr_sym;
+    // init options with prot bits
+    LZ78Options opts = lz78_default_options();
+    opts.protection = prot;
+    opts.bits = bits;
+    opts.policy = policy;
+    opts.dict = dict;
+    opts.engine = engine;
+    opts.level = level;
+    opts.checksum = checksum;
+    opts.format = lzw ? LZ78_LZW : LZ78_PAIRS;
+    opts.index = indexed;
+    opts.entropy = entropy;
+    opts.stored = stored;
+    if (sized && !many) {
+        opts.length = (uint64_t) (FileData.st_size - offset);
     }
-    // check if we're at root node, if not continue matching prefix
-    if (curr_node != root) {
-        //printf("prev_node->code = %u, prev_sym = %u\n", prev_node->code, prev_sym);
-        write_pair(outfile, prev_node->code, prev_sym, get_bitlen(next_code));
-        next_code = (next_code + 1) % MAX_CODE;
+    if (indexed && threads && !many) {
+        fprintf(stderr, "Chunked containers are indexed already, -x is for single streams.\n");
+        exit(1);
+    }
+    if (depth && (threads || many)) {
+        fprintf(stderr, "Rings are for a single stream, -p can't go with -t or -m.\n");
+        exit(1);
+    }
+    if (dict && lzw) {
+        fprintf(stderr, "LZW streams can't start from a dictionary.\n");
+        exit(1);
+    }
+    // levels only change how pairs are parsed once the dictionary is frozen
+    if (level > LZ78_MIN_LEVEL && (policy == LZ78_RESET || lzw)) {
+        fprintf(stderr, "Levels above %d need -r freeze or adaptive, and pairs rather than -w.\n",
+            LZ78_MIN_LEVEL);
+        exit(1);
+    }
+    if (dict && !lz78_dict_fits(dict, bits)) {
+        fprintf(stderr, "Dictionary has too many entries for %d bit codes.\n", bits);
+        exit(1);
     }
 
-    // signal end of compression using STOP_CODE and bit_length of next_code
-    //printf("prev_node->code = %u, prev_sym = %u\n", STOP_CODE, 0);
-    write_pair(outfile, STOP_CODE, 0, get_bitlen(next_code));
-
-    // flush any unwritten, buffered pairs
-    flush_pairs(outfile);
+    // make permission for outfile match protection bits in fileheader
+    if (!many) {
+        fchmod(outfile, opts.protection);
+    }
 
-    // delete trie
-    trie_delete(root);
+    uint64_t start = clock_ns();
+    LZ78Stats stats = { 0 };
+    LZ78Status status = LZ78_OK;
+    if (many) {
+        // every file gets its own output and protection bits, one worker per CPU by default
+        status = encode_many(
+            argv + optind, argc - optind, &opts, threads ? threads : pool_cpus(), &stats);
+    } else if (threads) {
+        // compress chunks in parallel into the chunked container
+        status = chunked_encode(infile, outfile, &opts, threads, chunk_size, &stats);
+    } else {
+        status = encode_stream(infile, outfile, &opts, depth, &stats);
+    }
 
     // close files
     close(infile);
     close(outfile);
+    uint64_t wall_ns = clock_ns() - start;
+    lz78_dict_delete(dict);
+
+    if (status != LZ78_OK) {
+        // files of a batch have said what went wrong with them
+        if (!many) {
+            fprintf(stderr, "%s.\n", lz78_strerror(status));
+        }
+        exit(1);
+    }
 
     // check for printing compression stats
     if (verbose) {
         // convert compressed total bits to bytes
         uint64_t bytes = 0;
-        if (total_bits % 8 == 0) {
-            bytes = total_bits / 8;
+        if (stats.bits % 8 == 0) {
+            bytes = stats.bits / 8;
         } else {
-            bytes = (total_bits / 8) + 1;
+            bytes = (stats.bits / 8) + 1;
         }
         fprintf(stderr, "Compressed file size: %" PRId64 " bytes\n", bytes);
-        fprintf(stderr, "Uncompressed file size: %" PRId64 " bytes\n", total_syms);
-        float space_saving = (100.0 * (1.0 - ((float) bytes / (float) total_syms)));
+        fprintf(stderr, "Uncompressed file size: %" PRId64 " bytes\n", stats.syms);
+        float space_saving = (100.0 * (1.0 - ((float) bytes / (float) stats.syms)));
         fprintf(stderr, "Space saving: %.2f%%\n", space_saving);
+        fprintf(stderr, "Peak dictionary memory: %" PRIu64 " bytes\n", stats.dict_bytes);
+        report_text(stderr, &stats, wall_ns);
+    }
+    if (json) {
+        const char *mode = many ? "batch" : threads ? "chunked" : "stream";
+        report_json(stderr, "encode", mode, &stats, wall_ns);
     }
     return 0;
 }
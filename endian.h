@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 
 static inline bool big_endian(void) {
     uint16_t word = 0x0001;
@@ -43,4 +44,34 @@ static inline uint64_t swap64(uint64_t x) {
     return result;
 }
 
+// loads 4 little endian bytes from p, which needn't be aligned
+static inline uint32_t load_le32(const uint8_t *p) {
+    uint32_t x;
+    memcpy(&x, p, sizeof(x));
+    return big_endian() ? swap32(x) : x;
+}
+
+// stores x as 4 little endian bytes at p, which needn't be aligned
+static inline void store_le32(uint8_t *p, uint32_t x) {
+    if (big_endian()) {
+        x = swap32(x);
+    }
+    memcpy(p, &x, sizeof(x));
+}
+
+// loads 8 little endian bytes from p, which needn't be aligned
+static inline uint64_t load_le64(const uint8_t *p) {
+    uint64_t x;
+    memcpy(&x, p, sizeof(x));
+    return big_endian() ? swap64(x) : x;
+}
+
+// stores x as 8 little endian bytes at p, which needn't be aligned
+static inline void store_le64(uint8_t *p, uint64_t x) {
+    if (big_endian()) {
+        x = swap64(x);
+    }
+    memcpy(p, &x, sizeof(x));
+}
+
 #endif
@@ -0,0 +1,107 @@
+#include "hash.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// log2 of a power of two
+static int log2_of(uint32_t n) {
+    int log = 0;
+    while (n >>= 1) {
+        log += 1;
+    }
+    return log;
+}
+
+// allocate an empty array of size slots and make it the table's
+static bool alloc_slots(HashTable *t, uint32_t size) {
+    HashSlot *slots = calloc(size, sizeof(HashSlot));
+    if (!slots) {
+        return false;
+    }
+    t->slots = slots;
+    t->mask = size - 1;
+    t->shift = 32 - log2_of(size);
+    return true;
+}
+
+// initialize a table
+HashTable *hash_create(void) {
+    HashTable *t = calloc(1, sizeof(HashTable));
+    // if successful, allocate the first slots
+    if (t && !alloc_slots(t, HASH_SLOTS)) {
+        free(t);
+        return NULL;
+    }
+    if (t) {
+        t->epoch = 1;
+    }
+    return t;
+}
+
+// reset a table to just the root
+void hash_reset(HashTable *t) {
+    // if t exists
+    if (t) {
+        t->count = 0;
+        t->epoch += 1;
+        // the epoch wrapped, so slots from 255 resets ago would look live again
+        if (t->epoch == 0) {
+            memset(t->slots, 0, ((size_t) t->mask + 1) * sizeof(HashSlot));
+            t->epoch = 1;
+        }
+    }
+}
+
+// delete a table and its slots
+void hash_delete(HashTable *t) {
+    // if t exists
+    if (t) {
+        free(t->slots);
+        free(t);
+    }
+}
+
+// bytes held by the table
+size_t hash_memory(HashTable *t) {
+    return t ? sizeof(HashTable) + ((size_t) t->mask + 1) * sizeof(HashSlot) : 0;
+}
+
+// put a key and code into the first empty slot of its probe sequence
+static inline void place(HashTable *t, uint32_t key, uint32_t code) {
+    uint32_t i = hash_index(t, key);
+    while ((uint8_t) t->slots[i].val == t->epoch) {
+        i = (i + 1) & t->mask;
+    }
+    t->slots[i].key = key;
+    t->slots[i].val = code << 8 | t->epoch;
+}
+
+// double the slots, moving the live entries over
+static bool grow(HashTable *t) {
+    HashSlot *old = t->slots;
+    uint32_t old_size = t->mask + 1;
+    uint8_t old_epoch = t->epoch;
+    if (!alloc_slots(t, old_size * 2)) {
+        return false;
+    }
+    // the new slots start out empty, so the epoch can start over too
+    t->epoch = 1;
+    for (uint32_t i = 0; i < old_size; i += 1) {
+        if ((uint8_t) old[i].val == old_epoch) {
+            place(t, old[i].key, old[i].val >> 8);
+        }
+    }
+    free(old);
+    return true;
+}
+
+// add the phrase of code extended by sym
+bool hash_insert(HashTable *t, uint32_t code, uint8_t sym, uint32_t child) {
+    // keep the table at most half full so probe sequences stay short
+    if ((t->count + 1) * 2 > t->mask + 1 && !grow(t)) {
+        return false;
+    }
+    place(t, code << 8 | sym, child);
+    t->count += 1;
+    return true;
+}
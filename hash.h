@@ -0,0 +1,88 @@
+#ifndef __HASH_H__
+#define __HASH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define HASH_SLOTS 4096 // Slots of a new table, doubled whenever it gets half full.
+
+/*
+ * One entry of the table: the phrase key (parent code << 8 | sym) and its
+ * code, with the epoch the entry was added in kept in the low byte of val.
+ * Slots from an earlier epoch count as empty.
+ */
+typedef struct HashSlot {
+    uint32_t key;
+    uint32_t val;
+} HashSlot;
+
+/*
+ * Dictionary engine that keeps every phrase in one flat array of slots,
+ * open addressed with linear probing. Phrases are looked up by the code of
+ * their prefix and their last symbol instead of by walking nodes.
+ */
+typedef struct HashTable {
+    HashSlot *slots;
+    uint32_t mask; // Slots - 1.
+    int shift; // 32 - log2(slots), turns a hash into a slot index.
+    uint32_t count; // Entries added since the last reset.
+    uint8_t epoch; // Never 0, so zeroed slots are empty.
+} HashTable;
+
+/*
+ * Constructor: Creates an empty table holding just the root, EMPTY_CODE
+ * Returns the newly allocated table, NULL if out of memory
+ */
+HashTable *hash_create(void);
+
+/*
+ * Resets the table: called when code reaches the dictionary's MAX_CODE
+ * Bumps the epoch so every slot reads as empty, slots are only cleared once
+ * every 255 resets when the epoch wraps
+ */
+void hash_reset(HashTable *t);
+
+/*
+ * Destructor: Deletes the table and its slots
+ */
+void hash_delete(HashTable *t);
+
+/*
+ * Returns the bytes held by the table
+ * Tables only grow until deleted, so this is also the peak
+ */
+size_t hash_memory(HashTable *t);
+
+/*
+ * Adds the phrase of code extended by sym as child
+ * Grows the table first if it is half full
+ * Returns false if allocation failed
+ */
+bool hash_insert(HashTable *t, uint32_t code, uint8_t sym, uint32_t child);
+
+/*
+ * Returns the slot index a key hashes to
+ */
+static inline uint32_t hash_index(const HashTable *t, uint32_t key) {
+    return (key * UINT32_C(0x9E3779B1)) >> t->shift;
+}
+
+/*
+ * Checks if the phrase of code has a child called sym
+ * Returns the code of the child if found, 0 (STOP_CODE) if absent
+ */
+static inline uint32_t hash_step(const HashTable *t, uint32_t code, uint8_t sym) {
+    uint32_t key = code << 8 | sym;
+    for (uint32_t i = hash_index(t, key);; i = (i + 1) & t->mask) {
+        const HashSlot *s = &t->slots[i];
+        if ((uint8_t) s->val != t->epoch) {
+            return 0;
+        }
+        if (s->key == key) {
+            return s->val >> 8;
+        }
+    }
+}
+
+#endif
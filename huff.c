@@ -0,0 +1,150 @@
+#include "huff.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// a value with its weight, for sorting
+typedef struct Leaf {
+    uint32_t weight;
+    uint16_t value;
+} Leaf;
+
+// lightest first, ties by value so the lengths don't depend on the sort
+static int by_weight(const void *a, const void *b) {
+    const Leaf *x = a, *y = b;
+    if (x->weight != y->weight) {
+        return x->weight < y->weight ? -1 : 1;
+    }
+    return x->value - y->value;
+}
+
+// Huffman code lengths of weights, however long, returns the longest
+// two queues: the leaves sorted, and the nodes merged from them, which
+// come out in order of weight, so the lightest two are always at the fronts
+static int build_lengths(const uint32_t *weights, uint8_t *lens) {
+    Leaf leaves[HUFF_SYMS];
+    int k = 0;
+    memset(lens, 0, HUFF_SYMS);
+    for (int v = 0; v < HUFF_SYMS; v += 1) {
+        if (weights[v]) {
+            leaves[k] = (Leaf) { weights[v], v };
+            k += 1;
+        }
+    }
+    if (k == 0) {
+        return 0;
+    }
+    if (k == 1) {
+        lens[leaves[0].value] = 1;
+        lens[leaves[0].value == 0 ? 1 : 0] = 1;
+        return 1;
+    }
+    qsort(leaves, k, sizeof(Leaf), by_weight);
+
+    // nodes 0..k) are the leaves, the merged ones follow in the order they're made
+    uint64_t weight[2 * HUFF_SYMS];
+    int parent[2 * HUFF_SYMS];
+    uint8_t depth[2 * HUFF_SYMS];
+    for (int i = 0; i < k; i += 1) {
+        weight[i] = leaves[i].weight;
+    }
+    int leaf = 0;
+    int merged = k;
+    for (int next = k; next < 2 * k - 1; next += 1) {
+        int pick[2];
+        for (int j = 0; j < 2; j += 1) {
+            if (leaf < k && (merged >= next || weight[leaf] <= weight[merged])) {
+                pick[j] = leaf;
+                leaf += 1;
+            } else {
+                pick[j] = merged;
+                merged += 1;
+            }
+        }
+        weight[next] = weight[pick[0]] + weight[pick[1]];
+        parent[pick[0]] = next;
+        parent[pick[1]] = next;
+    }
+    // every node's parent is made after it, so depths fill in from the root down
+    int longest = 0;
+    depth[2 * k - 2] = 0;
+    for (int i = 2 * k - 3; i >= 0; i -= 1) {
+        depth[i] = depth[parent[i]] + 1;
+    }
+    for (int i = 0; i < k; i += 1) {
+        lens[leaves[i].value] = depth[i];
+        longest = depth[i] > longest ? depth[i] : longest;
+    }
+    return longest;
+}
+
+// code lengths of at most HUFF_MAX bits
+void huff_lengths(const uint32_t *freqs, uint8_t *lens) {
+    uint32_t weights[HUFF_SYMS];
+    memcpy(weights, freqs, sizeof(weights));
+    // flatten the weights until the tree is shallow enough, rare values gain the most
+    while (build_lengths(weights, lens) > HUFF_MAX) {
+        for (int v = 0; v < HUFF_SYMS; v += 1) {
+            if (weights[v]) {
+                weights[v] = weights[v] / 2 + 1;
+            }
+        }
+    }
+}
+
+// reverse the low n bits of x
+static uint16_t reverse(uint32_t x, int n) {
+    uint16_t r = 0;
+    for (int i = 0; i < n; i += 1) {
+        r = (r << 1) | ((x >> i) & 1);
+    }
+    return r;
+}
+
+// canonical codes, shorter ones first and values in order within a length
+void huff_codes(const uint8_t *lens, uint16_t *codes) {
+    int counts[HUFF_MAX + 1] = { 0 };
+    for (int v = 0; v < HUFF_SYMS; v += 1) {
+        counts[lens[v]] += 1;
+    }
+    counts[0] = 0;
+    uint32_t next[HUFF_MAX + 1];
+    uint32_t code = 0;
+    for (int len = 1; len <= HUFF_MAX; len += 1) {
+        code = (code + counts[len - 1]) << 1;
+        next[len] = code;
+    }
+    for (int v = 0; v < HUFF_SYMS; v += 1) {
+        codes[v] = 0;
+        if (lens[v]) {
+            codes[v] = reverse(next[lens[v]], lens[v]);
+            next[lens[v]] += 1;
+        }
+    }
+}
+
+// decoding table, every entry a code's value and length
+bool huff_table(const uint8_t *lens, uint16_t *table) {
+    // a complete code covers every entry exactly once
+    uint32_t covered = 0;
+    for (int v = 0; v < HUFF_SYMS; v += 1) {
+        if (lens[v] > HUFF_MAX) {
+            return false;
+        }
+        covered += lens[v] ? HUFF_TABLE >> lens[v] : 0;
+    }
+    if (covered != HUFF_TABLE) {
+        return false;
+    }
+    uint16_t codes[HUFF_SYMS];
+    huff_codes(lens, codes);
+    for (int v = 0; v < HUFF_SYMS; v += 1) {
+        // the bits past a code are whatever follows it, each of them gets an entry
+        for (uint32_t i = codes[v]; lens[v] && i < HUFF_TABLE; i += 1u << lens[v]) {
+            table[i] = (uint16_t) (v | lens[v] << 8);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,39 @@
+#ifndef __HUFF_H__
+#define __HUFF_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define HUFF_SYMS 256 // Values a code table covers.
+#define HUFF_MAX 11 // Longest code, and the bits a decoding table is indexed by.
+#define HUFF_TABLE (1 << HUFF_MAX) // Entries of a decoding table.
+
+/*
+ * Canonical Huffman codes: a table is sent as the code length of each of
+ * the HUFF_SYMS values, 0 for values that don't occur, and both sides give
+ * the codes out in order of length, then value. Codes are bit reversed so
+ * they read from the LSB, like the rest of the stream.
+ */
+
+/*
+ * Fills lens with code lengths of at most HUFF_MAX bits for the values
+ * counted in freqs, the ones that don't occur get 0
+ * A single value is given a 1 bit code and a partner, so every table that
+ * has a value is a complete code
+ */
+void huff_lengths(const uint32_t *freqs, uint8_t *lens);
+
+/*
+ * Fills codes with the bit reversed canonical code of each value of lens
+ */
+void huff_codes(const uint8_t *lens, uint16_t *codes);
+
+/*
+ * Fills the HUFF_TABLE entries of table for decoding the code with lens:
+ * the entry at the next HUFF_MAX bits of input is the value in its low 8
+ * bits and its code length above them
+ * Returns false if lens isn't a complete code of at most HUFF_MAX bits
+ */
+bool huff_table(const uint8_t *lens, uint16_t *table);
+
+#endif
@@ -1,7 +1,13 @@
+#ifdef __linux__
+#define _GNU_SOURCE // For fallocate().
+#endif
+
 #include "io.h"
+#include "huff.h"
 #include "word.h"
 #include "code.h"
 #include "endian.h"
+#include "profile.h"
 
 #include <stdio.h>
 #include <stdint.h>
@@ -10,32 +16,21 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
-
-// buffer for syms
-static uint8_t syms_buff[BLOCK] = { 0 };
-static int syms_index = 0;
-static int syms_end = BLOCK + 1;
-
-// buffer for pairs
-static uint8_t pairs_buff[BLOCK] = { 0 };
-static int bit_index = 0;
-
-// total counts for syms and bits
-uint64_t total_syms = 0;
-uint64_t total_bits = 0;
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 // Reads in bytes until all bytes specified are actually read
 int read_bytes(int infile, uint8_t *buf, int to_read) {
+    PROFILE(PROF_READ_BYTES);
     // init vars for bytes read
     int total_read = 0;
     int curr_read = 0;
-    int new_to_read = to_read;
     // loop until end of file or read all of specified bytes
-    while (((curr_read = read(infile, buf, new_to_read)) > 0) && (total_read != to_read)) {
+    while ((total_read != to_read)
+           && ((curr_read = read(infile, buf + total_read, to_read - total_read)) > 0)) {
         // update vars for bytes read
         total_read += curr_read;
-        buf += total_read;
-        new_to_read -= total_read;
     }
     return total_read;
 }
@@ -45,238 +40,766 @@ int write_bytes(int outfile, uint8_t *buf, int to_write) {
     // init vars for bytes written
     int total_written = 0;
     int curr_written = 0;
-    int new_to_write = to_write;
-    // loop until end of file or written all of specified bytes
-    while (
-        ((curr_written = write(outfile, buf, new_to_write)) > 0) && (total_written != to_write)) {
+    // loop until error or written all of specified bytes
+    while ((total_written != to_write)
+           && ((curr_written = write(outfile, buf + total_written, to_write - total_written))
+               > 0)) {
         // update vars for bytes written
         total_written += curr_written;
-        buf += total_written;
-        new_to_write -= total_written;
     }
     return total_written;
 }
 
-// reads in sizeof(FileHeader) bytes from input file
-void read_header(int infile, FileHeader *header) {
-    // set bytes to_read as sizeof(FileHeader)
-    int to_read = sizeof(header);
-    // read in bytes to_read from infile into header buf w/ type casted header
-    read_bytes(infile, (uint8_t *) header, to_read);
-    // check endianness
-    if (big_endian()) {
-        // swap endianness for data in FileHeader
-        header->magic = swap32(header->magic);
-        header->protection = swap16(header->protection);
-    }
-    // add header bits to total
-    total_bits += (to_read * 8);
-}
-
-// reads in sizeof(FileHeader) bytes from input file
-void write_header(int outfile, FileHeader *header) {
-    // check endianness
-    if (big_endian()) {
-        // swap endianness for data in FileHeader
-        header->magic = swap32(header->magic);
-        header->protection = swap16(header->protection);
-    }
-    // set bytes to_write as sizeof(FileHeader)
-    int to_write = sizeof(header);
-    // write bytes to_write to outfile from header buf w/ typed casted header
-    write_bytes(outfile, (uint8_t *) header, to_write);
-    // add header bits to total
-    total_bits += (to_write * 8);
-}
-
-// reads in symbols in buffer
-bool read_sym(int infile, uint8_t *sym) {
-    // check if we're already reading a block
-    if (syms_index > 0) {
-        // set sym as current index in sym buffer
-        *sym = syms_buff[syms_index];
-        // update sym index
-        syms_index += 1;
-        // if we reach end of sym buffer, read new block
-        if (syms_index == BLOCK) {
-            // to read a new block, we have to reset syms index to 0
-            syms_index = 0;
+// write all of buf at offset of outfile, leaving its file offset alone
+bool write_at(int outfile, const uint8_t *buf, size_t len, uint64_t offset) {
+    while (len > 0) {
+        ssize_t written = pwrite(outfile, buf, len, (off_t) offset);
+        if (written <= 0) {
+            return false;
         }
+        buf += written;
+        len -= written;
+        offset += written;
     }
-    // read a new block
-    else {
-        int new_block = read_bytes(infile, syms_buff, BLOCK);
-        if (new_block < BLOCK) {
-            syms_end = new_block + 1;
+    return true;
+}
+
+// map the rest of a regular file
+bool map_file(int infile, Mapping *map) {
+    struct stat st;
+    off_t offset = lseek(infile, 0, SEEK_CUR);
+    if (offset == -1 || fstat(infile, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size <= offset) {
+        return false;
+    }
+    // maps have to start on a page, so map from 0 and skip to the offset
+    map->base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, infile, 0);
+    if (map->base == MAP_FAILED) {
+        return false;
+    }
+    madvise(map->base, st.st_size, MADV_SEQUENTIAL);
+    map->size = st.st_size;
+    map->data = map->base + offset;
+    map->len = st.st_size - offset;
+    return true;
+}
+
+// unmap a mapped file
+void unmap_file(Mapping *map) {
+    munmap(map->base, map->size);
+    map->base = NULL;
+    map->data = NULL;
+    map->size = 0;
+    map->len = 0;
+}
+
+// monotonic clock in nanoseconds
+uint64_t clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// sink for blocks going to a file descriptor
+bool fd_sink(void *ctx, const uint8_t *buf, size_t len) {
+    int outfile = *(int *) ctx;
+    return write_bytes(outfile, (uint8_t *) buf, len) == (int) len;
+}
+
+// sink dropping its input
+bool null_sink(void *ctx, const uint8_t *buf, size_t len) {
+    (void) ctx;
+    (void) buf;
+    (void) len;
+    return true;
+}
+
+// sink timing another sink
+bool timed_sink(void *ctx, const uint8_t *buf, size_t len) {
+    TimedSink *t = ctx;
+    uint64_t start = clock_ns();
+    bool ok = t->sink(t->ctx, buf, len);
+    t->ns += clock_ns() - start;
+    return ok;
+}
+
+// sink appending to a growable buffer
+bool buffer_sink(void *ctx, const uint8_t *buf, size_t len) {
+    Buffer *b = ctx;
+    if (b->len + len > b->cap) {
+        size_t cap = b->cap ? b->cap : BLOCK;
+        while (cap < b->len + len) {
+            cap *= 2;
+        }
+        uint8_t *data = realloc(b->data, cap);
+        if (!data) {
+            return false;
         }
-        // read sym in new block
-        *sym = syms_buff[syms_index];
-        // update sym index
-        syms_index += 1;
-    }
-    // check if there are still syms to read
-    if (syms_end != syms_index) {
-        total_syms += 1;
+        b->data = data;
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, buf, len);
+    b->len += len;
+    return true;
+}
+
+// grow a buffer ahead of appending to it
+bool buffer_reserve(Buffer *buf, size_t cap) {
+    if (cap <= buf->cap) {
         return true;
-    } else {
+    }
+    uint8_t *data = realloc(buf->data, cap);
+    if (!data) {
         return false;
     }
+    buf->data = data;
+    buf->cap = cap;
+    return true;
 }
 
-// write a pair to outfile (pair is buffered)
-void write_pair(int outfile, uint16_t code, uint8_t sym, int bitlen) {
-    // writing from LSB first, so check if big_endian
-    if (big_endian()) {
-        // swap endiannnes of code to LSB -> MSB
-        swap16(code);
+// reserve disk for output of a known length
+void preallocate(int outfile, uint64_t len) {
+#ifdef __linux__
+    // keeping the size means output that comes up short isn't padded with zeros
+    if (len > 0 && (uint64_t) (off_t) len == len) {
+        fallocate(outfile, FALLOC_FL_KEEP_SIZE, 0, (off_t) len);
     }
+#else
+    (void) outfile;
+    (void) len;
+#endif
+}
 
-    int code_bit = 0;
-    // looping while there are bits in code left to write
-    while (code_bit < bitlen) {
-        // check if buffer is full
-        if (bit_index == (BLOCK * 8)) {
-            // flush the buffer
-            flush_pairs(outfile);
-        }
-        // if bit in code is set
-        if ((code & (1UL << (code_bit % 16))) >> (code_bit % 16)) {
-            // set bit in buffer
-            pairs_buff[bit_index / 8] |= (1UL << (bit_index % 8));
-        }
-        // inc bit count in code and bit index
-        code_bit += 1;
-        bit_index += 1;
-    }
-
-    int sym_bit = 0;
-    // looping while there are bits in syms left to write
-    while (sym_bit < 8) {
-        // if buffer is full
-        if (bit_index == (BLOCK * 8)) {
-            // flush the buffer
-            flush_pairs(outfile);
-        }
-        // if bit in sym is set
-        if ((sym & (1UL << (sym_bit % 8))) >> (sym_bit % 8)) {
-            // set bit in buffer
-            pairs_buff[bit_index / 8] |= (1UL << (bit_index % 8));
-        }
+// give back disk reserved past the end of a file
+bool release_preallocated(int outfile) {
+    struct stat st;
+    // truncating to its own size frees blocks kept past the end
+    return fstat(outfile, &st) == 0 && S_ISREG(st.st_mode) && ftruncate(outfile, st.st_size) == 0;
+}
 
-        // inc bit count in sym and bit index
-        sym_bit += 1;
-        bit_index += 1;
+// bytes from the current offset of a regular file to its end
+uint64_t file_left(int infile) {
+    struct stat st;
+    off_t offset = lseek(infile, 0, SEEK_CUR);
+    if (offset == -1 || fstat(infile, &st) == -1 || !S_ISREG(st.st_mode)) {
+        return UINT64_MAX;
     }
+    return st.st_size > offset ? (uint64_t) (st.st_size - offset) : 0;
+}
+
+// decodes HEADER_SIZE bytes of little endian header fields
+void read_header(const uint8_t *buf, FileHeader *header) {
+    header->magic = (uint32_t) buf[0] | (uint32_t) buf[1] << 8 | (uint32_t) buf[2] << 16
+                    | (uint32_t) buf[3] << 24;
+    header->protection = (uint16_t) (buf[4] | buf[5] << 8);
+    header->bits = buf[6];
+    header->flags = buf[7];
+    header->length = 0;
+}
+
+// the fixed header and whichever optional fields the flags call for
+int header_size(uint8_t flags) {
+    return HEADER_SIZE + (flags & FLAG_DICT ? DICT_ID_SIZE : 0)
+           + (flags & FLAG_SIZE ? LENGTH_SIZE : 0);
+}
+
+// encodes the header as HEADER_SIZE little endian bytes
+void write_header(uint8_t *buf, FileHeader *header) {
+    buf[0] = header->magic & 0xFF;
+    buf[1] = (header->magic >> 8) & 0xFF;
+    buf[2] = (header->magic >> 16) & 0xFF;
+    buf[3] = (header->magic >> 24) & 0xFF;
+    buf[4] = header->protection & 0xFF;
+    buf[5] = (header->protection >> 8) & 0xFF;
+    buf[6] = header->bits;
+    buf[7] = header->flags;
+}
+
+// mask of the low n bits, n < 64
+#define MASK(n) ((UINT64_C(1) << (n)) - 1)
 
+// lists every code width with a specialized fast path, wider codes take the generic one
+#define PAIR_WIDTHS(X)                                                                             \
+    X(1) X(2) X(3) X(4) X(5) X(6) X(7) X(8) X(9) X(10) X(11) X(12) X(13) X(14) X(15) X(16)
+
+// set up an empty pair writer that hands blocks to sink
+void pw_init(PairWriter *pw, Sink sink, void *ctx) {
+    pw->index = 0;
+    pw->acc = 0;
+    pw->count = 0;
+    pw->total_bits = 0;
+    pw->sink = sink;
+    pw->ctx = ctx;
+    pw->error = false;
+}
+
+// append n bits to the accumulator, committing whole bytes to the buffer
+static inline void put_bits(PairWriter *pw, uint64_t bits, int n) {
+    pw->acc |= bits << pw->count;
+    pw->count += n;
+    // store all 8 bytes, only the whole ones are committed
+    store_le64(pw->buff + pw->index, pw->acc);
+    int bytes = pw->count >> 3;
+    pw->index += bytes;
+    pw->acc >>= bytes * 8;
+    pw->count &= 7;
+}
+
+// append a pair: code goes first from its LSB, then the 8 bits of sym
+static inline void put_pair(PairWriter *pw, uint32_t code, uint8_t sym, int bitlen) {
+    put_bits(pw, (uint64_t) code | ((uint64_t) sym << bitlen), bitlen + 8);
+}
+
+// hand over the full block and keep the bytes that spilled past it
+static void spill_block(PairWriter *pw) {
+    if (!pw->sink(pw->ctx, pw->buff, BLOCK)) {
+        pw->error = true;
+    }
+    pw->index -= BLOCK;
+    memcpy(pw->buff, pw->buff + BLOCK, pw->index);
+}
+
+// write a pair to the pair writer (pair is buffered)
+void write_pair(PairWriter *pw, uint32_t code, uint8_t sym, int bitlen) {
+    PROFILE(PROF_WRITE_PAIR);
+    // pick the fast path with a constant code width
+    switch (bitlen) {
+#define WRITE_WIDTH(n)                                                                             \
+    case n: put_pair(pw, code, sym, n); break;
+        PAIR_WIDTHS(WRITE_WIDTH)
+#undef WRITE_WIDTH
+    default: put_pair(pw, code, sym, bitlen); break;
+    }
+    // check if buffer is full
+    if (pw->index >= BLOCK) {
+        spill_block(pw);
+    }
     // inc total bits by bits in code + sym
-    total_bits += (bitlen + 8);
+    pw->total_bits += (bitlen + 8);
 }
 
-// write out remaining pairs to the output file
-void flush_pairs(int outfile) {
-    // convert bits to bytes to_flush
-    int to_flush;
-    if (bit_index % 8 == 0) {
-        to_flush = bit_index / 8;
-    } else {
-        to_flush = (bit_index / 8) + 1;
+// write a code on its own (code is buffered)
+void write_code(PairWriter *pw, uint32_t code, int bitlen) {
+    switch (bitlen) {
+#define WRITE_WIDTH(n)                                                                             \
+    case n: put_bits(pw, code, n); break;
+        PAIR_WIDTHS(WRITE_WIDTH)
+#undef WRITE_WIDTH
+    default: put_bits(pw, code, bitlen); break;
+    }
+    if (pw->index >= BLOCK) {
+        spill_block(pw);
+    }
+    pw->total_bits += bitlen;
+}
+
+// append n pairs of one code width, handing over each block as it fills
+static inline void put_pairs(
+    PairWriter *pw, const uint32_t *codes, const uint8_t *syms, int n, int bitlen) {
+    for (int i = 0; i < n; i += 1) {
+        if (syms) {
+            put_pair(pw, codes[i], syms[i], bitlen);
+        } else {
+            put_bits(pw, codes[i], bitlen);
+        }
+        if (pw->index >= BLOCK) {
+            spill_block(pw);
+        }
+    }
+}
+
+// write a batch of pairs, the code width is picked once for all of them
+void write_pairs(PairWriter *pw, const uint32_t *codes, const uint8_t *syms, int n, int bitlen) {
+    PROFILE(PROF_WRITE_PAIRS);
+    switch (bitlen) {
+#define WRITE_WIDTH(b)                                                                             \
+    case b: put_pairs(pw, codes, syms, n, b); break;
+        PAIR_WIDTHS(WRITE_WIDTH)
+#undef WRITE_WIDTH
+    default: put_pairs(pw, codes, syms, n, bitlen); break;
+    }
+    pw->total_bits += (uint64_t) n * (bitlen + (syms ? 8 : 0));
+}
+
+// hand the remaining pairs to the sink
+void flush_pairs(PairWriter *pw) {
+    // a partial byte left in the accumulator is padded with zeros
+    if (pw->count > 0) {
+        pw->buff[pw->index] = pw->acc & 0xFF;
+        pw->index += 1;
     }
     // flush the toilet (from index 0 to curr index)
-    write_bytes(outfile, pairs_buff, to_flush);
-    // reset pairs buffer
-    memset(pairs_buff, 0, BLOCK);
-    // reset bit index
-    bit_index = 0;
-}
-
-// read a pair from the input file and pass into pointers
-bool read_pair(int infile, uint16_t *code, uint8_t *sym, int bitlen) {
-    // reset code and sym when reading in new pair
-    memset(code, 0, sizeof(uint16_t));
-    memset(sym, 0, sizeof(uint8_t));
-
-    // looping while there are bits in code left to read
-    int code_bit = 0;
-    while (code_bit < bitlen) {
-        // if all bits processed, read another block
-        if (bit_index == 0) {
-            read_bytes(infile, pairs_buff, BLOCK);
+    if (pw->index > 0 && !pw->sink(pw->ctx, pw->buff, pw->index)) {
+        pw->error = true;
+    }
+    // reset accumulator and pairs index
+    pw->acc = 0;
+    pw->count = 0;
+    pw->index = 0;
+}
+
+// pad the pairs to a byte and hand them over, then the raw bytes at buf without copying
+void write_raw(PairWriter *pw, const uint8_t *buf, size_t len) {
+    flush_pairs(pw);
+    if (len > 0 && !pw->sink(pw->ctx, buf, len)) {
+        pw->error = true;
+    }
+    pw->total_bits += len * 8;
+}
+
+// pad the pairs to a byte and append raw bytes after them
+void write_tail(PairWriter *pw, const uint8_t *buf, int len) {
+    // a partial byte left in the accumulator is padded with zeros
+    if (pw->count > 0) {
+        pw->buff[pw->index] = pw->acc & 0xFF;
+        pw->index += 1;
+        pw->total_bits += 8 - pw->count;
+        pw->acc = 0;
+        pw->count = 0;
+    }
+    // the room past BLOCK takes the tail, full blocks go out as usual
+    memcpy(pw->buff + pw->index, buf, len);
+    pw->index += len;
+    if (pw->index >= BLOCK) {
+        if (!pw->sink(pw->ctx, pw->buff, BLOCK)) {
+            pw->error = true;
+        }
+        pw->index -= BLOCK;
+        memcpy(pw->buff, pw->buff + BLOCK, pw->index);
+    }
+    pw->total_bits += len * 8;
+}
+
+// set up an empty pair coder, for codes alone if lzw
+void pc_init(PairCoder *pc, bool lzw) {
+    pc->count = 0;
+    pc->lzw = lzw;
+}
+
+// add a pair to the block, writing it once it's full
+void code_pair(PairCoder *pc, PairWriter *pw, uint32_t code, uint8_t sym, int bitlen) {
+    pc->codes[pc->count] = code;
+    pc->syms[pc->count] = sym;
+    pc->widths[pc->count] = bitlen;
+    pc->count += 1;
+    if (pc->count == CODER_BLOCK) {
+        flush_coder(pc, pw);
+    }
+}
+
+// add a batch of pairs of one code width, writing each block as it fills
+void code_pairs(
+    PairCoder *pc, PairWriter *pw, const uint32_t *codes, const uint8_t *syms, int n, int bitlen) {
+    while (n > 0) {
+        int take = CODER_BLOCK - pc->count;
+        if (take > n) {
+            take = n;
         }
-        // set bit in code as corresponding bit in buff
-        if ((pairs_buff[bit_index / 8] & (1UL << (bit_index % 8))) >> (bit_index % 8)) {
-            *code |= (1 << (code_bit % 16));
+        memcpy(pc->codes + pc->count, codes, take * sizeof(uint32_t));
+        if (syms) {
+            memcpy(pc->syms + pc->count, syms, take);
+            syms += take;
         }
+        memset(pc->widths + pc->count, bitlen, take);
+        pc->count += take;
+        codes += take;
+        n -= take;
+        if (pc->count == CODER_BLOCK) {
+            flush_coder(pc, pw);
+        }
+    }
+}
 
-        // inc bit count in code and bit index
-        code_bit += 1;
-        bit_index += 1;
+// bits below a code's top CODE_HIGH bits, they go as they are
+static inline int low_bits(int bitlen) {
+    return bitlen > CODE_HIGH ? bitlen - CODE_HIGH : 0;
+}
 
-        // if we're at the end of the BLOCK, reset index
-        if (bit_index == (BLOCK * 8)) {
-            bit_index = 0;
+// write the pairs as they'd be written without a coder, in runs of one code width
+static void write_plain(PairCoder *pc, PairWriter *pw) {
+    int i = 0;
+    while (i < pc->count) {
+        int run = 1;
+        while (i + run < pc->count && pc->widths[i + run] == pc->widths[i]) {
+            run += 1;
         }
+        write_pairs(pw, pc->codes + i, pc->lzw ? NULL : pc->syms + i, run, pc->widths[i]);
+        i += run;
     }
+}
 
-    // looping while there are bits left in sym to read
-    int sym_bit = 0;
-    while (sym_bit < 8) {
-        // if all bits processed, read another block
-        if (bit_index == 0) {
-            read_bytes(infile, pairs_buff, BLOCK);
+// write the tables and then each pair as its top bits' code, its low bits and its symbol's code
+static void write_huffman(PairCoder *pc, PairWriter *pw, uint8_t (*lens)[HUFF_SYMS]) {
+    for (int t = 0; t < (pc->lzw ? 1 : 2); t += 1) {
+        for (int v = 0; v < HUFF_SYMS; v += 1) {
+            write_code(pw, lens[t][v], LENGTH_BITS);
         }
-        // set bit in sym as corresponding bit in sym
-        if ((pairs_buff[bit_index / 8] & (1UL << (bit_index % 8))) >> (bit_index % 8)) {
-            *sym |= (1 << (sym_bit % 8));
+    }
+    uint16_t high[HUFF_SYMS];
+    uint16_t syms[HUFF_SYMS];
+    huff_codes(lens[0], high);
+    huff_codes(lens[1], syms);
+    uint64_t total = 0;
+    for (int i = 0; i < pc->count; i += 1) {
+        int shift = low_bits(pc->widths[i]);
+        uint32_t top = pc->codes[i] >> shift;
+        uint64_t bits = high[top] | (pc->codes[i] & MASK(shift)) << lens[0][top];
+        int n = lens[0][top] + shift;
+        if (!pc->lzw) {
+            bits |= (uint64_t) syms[pc->syms[i]] << n;
+            n += lens[1][pc->syms[i]];
         }
+        put_bits(pw, bits, n);
+        if (pw->index >= BLOCK) {
+            spill_block(pw);
+        }
+        total += n;
+    }
+    pw->total_bits += total;
+}
 
-        // inc bit count in sym and bit index
-        bit_index += 1;
-        sym_bit += 1;
-        // if we're at the end of the BLOCK, reset index
-        if (bit_index == (BLOCK * 8)) {
-            bit_index = 0;
+// write the pairs added so far as a block, Huffman coded if that comes out smaller
+void flush_coder(PairCoder *pc, PairWriter *pw) {
+    if (pc->count == 0) {
+        return;
+    }
+    uint32_t freqs[2][HUFF_SYMS] = { { 0 } };
+    uint64_t plain = 0;
+    uint64_t low = 0;
+    for (int i = 0; i < pc->count; i += 1) {
+        int shift = low_bits(pc->widths[i]);
+        freqs[0][pc->codes[i] >> shift] += 1;
+        freqs[1][pc->syms[i]] += 1;
+        plain += pc->widths[i];
+        low += shift;
+    }
+    // the cost of each table is its lengths and the codes it gives
+    uint8_t lens[2][HUFF_SYMS] = { { 0 } };
+    uint64_t coded = low;
+    for (int t = 0; t < (pc->lzw ? 1 : 2); t += 1) {
+        huff_lengths(freqs[t], lens[t]);
+        coded += HUFF_SYMS * LENGTH_BITS;
+        for (int v = 0; v < HUFF_SYMS; v += 1) {
+            coded += (uint64_t) freqs[t][v] * lens[t][v];
         }
     }
+    plain += pc->lzw ? 0 : (uint64_t) pc->count * 8;
+    bool huffman = coded < plain;
+    write_code(pw, (huffman ? 1 : 0) | (uint32_t) pc->count << 1, 1 + CODER_COUNT);
+    if (huffman) {
+        write_huffman(pc, pw, lens);
+    } else {
+        write_plain(pc, pw);
+    }
+    pc->count = 0;
+}
+
+// set up a pair reader with no input yet
+void pr_init(PairReader *pr) {
+    pr->next = NULL;
+    pr->end = NULL;
+    pr->acc = 0;
+    pr->count = 0;
+    pr->total_bits = 0;
+}
+
+// give the pair reader the next span of input
+void pr_feed(PairReader *pr, const uint8_t *buf, size_t len) {
+    pr->next = buf;
+    pr->end = buf + len;
+}
+
+// top up the accumulator from the current span, up to 56 bits or the end of the span
+static void refill_pairs(PairReader *pr) {
+    if (pr->end - pr->next >= 8) {
+        // whole word available, load it unaligned and keep the whole bytes that fit
+        pr->acc |= load_le64(pr->next) << pr->count;
+        int bytes = (63 - pr->count) >> 3;
+        pr->next += bytes;
+        pr->count += bytes * 8;
+        return;
+    }
+    // near the tail of the span, go a byte at a time
+    while (pr->count <= 56 && pr->next < pr->end) {
+        pr->acc |= (uint64_t) *pr->next << pr->count;
+        pr->next += 1;
+        pr->count += 8;
+    }
+}
+
+// take n bits off the accumulator if they're all there
+static inline bool get_bits(PairReader *pr, uint64_t *bits, int n) {
+    if (pr->count < n) {
+        refill_pairs(pr);
+        if (pr->count < n) {
+            return false;
+        }
+    }
+    *bits = pr->acc & MASK(n);
+    pr->acc >>= n;
+    pr->count -= n;
+    return true;
+}
+
+// take a pair off the accumulator if it's all there
+static inline bool get_pair(PairReader *pr, uint32_t *code, uint8_t *sym, int bitlen) {
+    uint64_t bits = 0;
+    if (!get_bits(pr, &bits, bitlen + 8)) {
+        return false;
+    }
+    *code = bits & MASK(bitlen);
+    *sym = bits >> bitlen;
+    return true;
+}
+
+// take a code off the accumulator if it's all there
+static inline bool get_code(PairReader *pr, uint32_t *code, int bitlen) {
+    uint64_t bits = 0;
+    if (!get_bits(pr, &bits, bitlen)) {
+        return false;
+    }
+    *code = bits;
+    return true;
+}
+
+// read a pair from the fed input and pass into pointers
+bool read_pair(PairReader *pr, uint32_t *code, uint8_t *sym, int bitlen) {
+    PROFILE(PROF_READ_PAIR);
+    bool read = false;
+    // pick the fast path with a constant code width
+    switch (bitlen) {
+#define READ_WIDTH(n)                                                                              \
+    case n: read = get_pair(pr, code, sym, n); break;
+        PAIR_WIDTHS(READ_WIDTH)
+#undef READ_WIDTH
+    default: read = get_pair(pr, code, sym, bitlen); break;
+    }
     // inc total bits by bits in code + sym
-    total_bits += (bitlen + 8);
+    if (read) {
+        pr->total_bits += (bitlen + 8);
+    }
+    return read;
+}
 
-    // check endiannness
-    if (big_endian()) {
-        // if code is in big endian, swap to little (LSB -> MSB)
-        *code = swap16(*code);
+// read a code on its own from the fed input
+bool read_code(PairReader *pr, uint32_t *code, int bitlen) {
+    bool read = false;
+    switch (bitlen) {
+#define READ_WIDTH(n)                                                                              \
+    case n: read = get_code(pr, code, n); break;
+        PAIR_WIDTHS(READ_WIDTH)
+#undef READ_WIDTH
+    default: read = get_code(pr, code, bitlen); break;
+    }
+    if (read) {
+        pr->total_bits += bitlen;
     }
+    return read;
+}
 
-    // there are pairs left to read if read code != STOP_CODE
-    if (*code != STOP_CODE) {
-        return true;
+// read the type and count of the next block, and its tables if it has them
+// the tables may come in pieces, each length is read whole or not at all
+static bool start_block(PairReader *pr, PairDecoder *pd, bool lzw) {
+    uint64_t bits = 0;
+    if (pd->want == 0) {
+        if (!get_bits(pr, &bits, 1 + CODER_COUNT)) {
+            return false;
+        }
+        pr->total_bits += 1 + CODER_COUNT;
+        pd->count = bits >> 1;
+        if (pd->count == 0 || pd->count > CODER_BLOCK) {
+            pd->corrupt = true;
+            return false;
+        }
+        pd->plain = !(bits & 1);
+        if (pd->plain) {
+            pd->left = pd->count;
+            return true;
+        }
+        pd->want = HUFF_SYMS * (lzw ? 1 : 2);
+        pd->got = 0;
     }
-    return false;
+    while (pd->got < pd->want) {
+        if (!get_bits(pr, &bits, LENGTH_BITS)) {
+            return false;
+        }
+        pr->total_bits += LENGTH_BITS;
+        pd->lens[pd->got] = bits;
+        pd->got += 1;
+    }
+    pd->want = 0;
+    if (!huff_table(pd->lens, pd->high) || (!lzw && !huff_table(pd->lens + HUFF_SYMS, pd->syms))) {
+        pd->corrupt = true;
+        return false;
+    }
+    pd->left = pd->count;
+    return true;
 }
 
-// write a word to the output file
-void write_word(int outfile, Word *w) {
-    uint32_t word_index = 0;
-    // looping through syms in word
-    while (word_index < w->len) {
-        // check if buffer is filled
-        if (syms_index == BLOCK) {
-            // flush buffer
-            flush_words(outfile);
+// read a pair out of the coded blocks
+bool read_coded(PairReader *pr, PairDecoder *pd, uint32_t *code, uint8_t *sym, int bitlen) {
+    if (pd->left == 0 && !start_block(pr, pd, !sym)) {
+        return false;
+    }
+    if (pd->plain) {
+        bool read = sym ? read_pair(pr, code, sym, bitlen) : read_code(pr, code, bitlen);
+        if (read) {
+            pd->left -= 1;
+        }
+        return read;
+    }
+    // the longest pair is two codes and the low bits, the bits past the input
+    // fed so far only ever pick out codes that end past it, which are turned down
+    if (pr->count < 2 * HUFF_MAX + MAX_BITS - CODE_HIGH) {
+        refill_pairs(pr);
+    }
+    int shift = low_bits(bitlen);
+    uint64_t acc = pr->acc;
+    uint16_t top = pd->high[acc & MASK(HUFF_MAX)];
+    int n = top >> 8;
+    uint32_t c = (uint32_t) (top & 0xFF) << shift | ((acc >> n) & MASK(shift));
+    n += shift;
+    uint16_t s = 0;
+    if (sym) {
+        s = pd->syms[(acc >> n) & MASK(HUFF_MAX)];
+        n += s >> 8;
+    }
+    if (n > pr->count) {
+        return false;
+    }
+    pr->acc >>= n;
+    pr->count -= n;
+    pr->total_bits += n;
+    pd->left -= 1;
+    *code = c;
+    if (sym) {
+        *sym = s & 0xFF;
+    }
+    return true;
+}
+
+// read raw bytes after the pairs
+int read_tail(PairReader *pr, uint8_t *buf, int len) {
+    // input is whole bytes, so the bits left over a byte boundary are padding
+    pr->total_bits += pr->count & 7;
+    pr->acc >>= pr->count & 7;
+    pr->count &= ~7;
+    int read = 0;
+    // bytes already in the accumulator come first
+    while (read < len && pr->count > 0) {
+        buf[read] = pr->acc & 0xFF;
+        pr->acc >>= 8;
+        pr->count -= 8;
+        read += 1;
+    }
+    // refills leave a copy of the next byte above count, it's read from the input now
+    if (pr->count == 0) {
+        pr->acc = 0;
+    }
+    while (read < len && pr->next < pr->end) {
+        buf[read] = *pr->next;
+        pr->next += 1;
+        read += 1;
+    }
+    pr->total_bits += read * 8;
+    return read;
+}
+
+// hand out raw bytes after the pairs, from the input itself once the accumulator is empty
+size_t read_span(PairReader *pr, const uint8_t **span, size_t len) {
+    pr->total_bits += pr->count & 7;
+    pr->acc >>= pr->count & 7;
+    pr->count &= ~7;
+    size_t read = 0;
+    if (pr->count > 0) {
+        // bytes already in the accumulator can't be pointed at, they're copied out
+        while (read < len && pr->count > 0) {
+            pr->held[read] = pr->acc & 0xFF;
+            pr->acc >>= 8;
+            pr->count -= 8;
+            read += 1;
+        }
+        *span = pr->held;
+    } else {
+        // refills leave a copy of the next byte above count, it's skipped now
+        pr->acc = 0;
+        read = (size_t) (pr->end - pr->next) < len ? (size_t) (pr->end - pr->next) : len;
+        *span = pr->next;
+        pr->next += read;
+    }
+    pr->total_bits += read * 8;
+    return read;
+}
+
+// set up an empty word writer that hands blocks to sink
+void ww_init(WordWriter *ww, Sink sink, void *ctx) {
+    ww->index = 0;
+    ww->spill = NULL;
+    ww->spill_size = 0;
+    ww->total_syms = 0;
+    ww->sink = sink;
+    ww->ctx = ctx;
+    ww->error = false;
+}
+
+// free the spill buffer of a word writer
+void ww_free(WordWriter *ww) {
+    free(ww->spill);
+    ww->spill = NULL;
+    ww->spill_size = 0;
+}
+
+// write the word at code in the WordTable to the word writer
+void write_word(WordWriter *ww, WordTable *wt, uint32_t code) {
+    PROFILE(PROF_WRITE_WORD);
+    uint32_t len = wt[code].len;
+    // check if the word fits in what's left of the buffer
+    if (ww->index + len > BLOCK) {
+        // flush buffer
+        flush_words(ww);
+    }
+    if (len <= BLOCK) {
+        // spell the word straight into the buffer
+        wt_spell(wt, code, ww->buff + ww->index);
+        ww->index += len;
+    } else {
+        // word is longer than a whole block, spell it into the spill buffer
+        if (len > ww->spill_size) {
+            free(ww->spill);
+            ww->spill = malloc(len);
+            ww->spill_size = ww->spill ? len : 0;
+        }
+        if (!ww->spill) {
+            ww->error = true;
+        } else {
+            wt_spell(wt, code, ww->spill);
+            if (!ww->sink(ww->ctx, ww->spill, len)) {
+                ww->error = true;
+            }
         }
-        // place each symbol in word to buffer
-        syms_buff[syms_index] = w->syms[word_index];
-        // inc syms index within buffer and word after placing symbol
-        syms_index += 1;
-        word_index += 1;
     }
     // inc total syms by syms in word
-    total_syms += w->len;
+    ww->total_syms += len;
+}
+
+// write symbols as they are, buffering only what fits
+void write_syms(WordWriter *ww, const uint8_t *buf, size_t len) {
+    if (ww->index + len <= BLOCK) {
+        memcpy(ww->buff + ww->index, buf, len);
+        ww->index += len;
+    } else {
+        flush_words(ww);
+        if (!ww->sink(ww->ctx, buf, len)) {
+            ww->error = true;
+        }
+    }
+    ww->total_syms += len;
 }
 
 // flush the words in the toilet
-void flush_words(int outfile) {
-    // from index 0 to curr index, print out all syms in buff
-    write_bytes(outfile, syms_buff, syms_index);
-    memset(syms_buff, 0, BLOCK);
-    syms_index = 0;
+void flush_words(WordWriter *ww) {
+    // from index 0 to curr index, hand over all syms in buff
+    if (ww->index > 0 && !ww->sink(ww->ctx, ww->buff, ww->index)) {
+        ww->error = true;
+    }
+    ww->index = 0;
 }
@@ -1,39 +1,379 @@
 #ifndef __IO_H__
 #define __IO_H__
 
+#include "huff.h"
 #include "word.h"
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
 #define BLOCK 4096 // 4KB blocks.
 #define MAGIC 0xBAADBAAC // Unique encoder/decoder magic number.
+#define HEADER_SIZE 8 // Bytes taken by a FileHeader in a file.
+#define FLAG_POLICY 0x03 // Flag bits holding the dictionary policy, see LZ78Policy.
+#define FLAG_DICT 0x04 // Stream starts from a pretrained dictionary, its ID follows the header.
+#define FLAG_CRC 0x08 // A CRC32C of the uncompressed data follows the STOP_CODE pair.
+#define FLAG_SIZE 0x10 // The uncompressed length follows the header, after any dictionary ID.
+#define FLAG_LZW 0x20 // Codes only, no symbols, see LZ78_LZW.
+#define FLAG_STORED 0x40 // A block type follows each STOP_CODE, see BLOCK_STORED.
+#define FLAG_ENTROPY 0x80 // Pairs come in coded blocks, see PairCoder.
+// Every flag bit this version understands.
+#define FLAGS_KNOWN                                                                                \
+    (FLAG_POLICY | FLAG_DICT | FLAG_CRC | FLAG_SIZE | FLAG_LZW | FLAG_STORED | FLAG_ENTROPY)
+#define DICT_ID_SIZE 4 // Bytes of the dictionary ID after the header.
+#define LENGTH_SIZE 8 // Bytes of the uncompressed length after the header.
+#define HEADER_MAX (HEADER_SIZE + DICT_ID_SIZE + LENGTH_SIZE) // Bytes of the largest header.
+#define CRC_SIZE 4 // Bytes of the CRC32C trailer, from the byte after the STOP_CODE pair.
+#define BLOCK_END 0 // Block type: the stream is over.
+#define BLOCK_STORED 1 // Block type: bytes stored as they are follow.
+#define STORED_SIZE 4 // Bytes of the length ahead of a stored block.
+#define CODER_BLOCK (1 << 14) // Most pairs in a coded block.
+#define CODER_COUNT 16 // Bits of the pair count of a coded block.
+#define CODE_HIGH 8 // Top bits of a code that are Huffman coded, the rest go as they are.
+#define LENGTH_BITS 4 // Bits of each code length of a Huffman table.
 
-extern uint64_t total_syms; // To count the symbols processed.
-extern uint64_t total_bits; // To count the bits processed.
-
+/*
+ * Stream header, all fields little endian:
+ *
+ *   magic           4 bytes MAGIC
+ *   protection      2 bytes, mode bits of the original file
+ *   bits            1 byte code width, 0 for DEFAULT_BITS
+ *   flags           1 byte FLAG_* bits
+ *   dictionary ID   4 bytes, with FLAG_DICT
+ *   length          8 bytes uncompressed length, with FLAG_SIZE
+ *
+ * The flags are the header's version: each optional field is there only
+ * if its flag is set, so older streams read exactly as they always have and
+ * streams with flags a decoder doesn't know are turned away.
+ *
+ * With FLAG_STORED a block type follows each STOP_CODE, as the symbol of the
+ * STOP_CODE pair or, with FLAG_LZW, the 8 bits after the code. BLOCK_END ends
+ * the codes as STOP_CODE alone does in other streams. BLOCK_STORED is
+ * followed, from the next whole byte, by a 4 byte length and that many bytes
+ * of input as they are, then the codes carry on from the byte after them with
+ * the dictionary as it was.
+ *
+ * With FLAG_ENTROPY the pairs up to and including each STOP_CODE come in
+ * coded blocks, see PairCoder, and whatever follows a STOP_CODE starts
+ * after its block as it does after the pair in other streams.
+ */
 typedef struct FileHeader {
     uint32_t magic;
     uint16_t protection;
+    uint8_t bits; // Code width of the dictionary, 0 in files that predate it.
+    uint8_t flags; // Stream features, 0 in files that predate them.
+    uint64_t length; // Uncompressed length, only with FLAG_SIZE.
 } FileHeader;
 
+/*
+ * Where buffered output goes once a block fills or is flushed
+ * ctx is passed back untouched
+ * Returns false if the bytes couldn't be taken
+ */
+typedef bool (*Sink)(void *ctx, const uint8_t *buf, size_t len);
+
+/*
+ * Passes output on to another sink, adding up the time spent in it
+ */
+typedef struct TimedSink {
+    Sink sink;
+    void *ctx;
+    uint64_t ns;
+} TimedSink;
+
+/*
+ * Growable in-memory output, see buffer_sink()
+ */
+typedef struct Buffer {
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+} Buffer;
+
+/*
+ * A regular file mapped into memory, see map_file()
+ */
+typedef struct Mapping {
+    uint8_t *base;
+    size_t size;
+    const uint8_t *data;
+    size_t len;
+} Mapping;
+
+/*
+ * Buffers pairs bit by bit, handing whole blocks to its sink
+ */
+typedef struct PairWriter {
+    uint8_t buff[BLOCK + 8]; // Room past BLOCK for whole word stores.
+    int index;
+    uint64_t acc; // Pending bits, starting at the LSB.
+    int count;
+    uint64_t total_bits;
+    Sink sink;
+    void *ctx;
+    bool error;
+} PairWriter;
+
+/*
+ * Pulls pairs out of input that is handed over a span at a time
+ */
+typedef struct PairReader {
+    const uint8_t *next;
+    const uint8_t *end;
+    uint64_t acc; // Bits read ahead, starting at the LSB.
+    int count;
+    uint64_t total_bits;
+    uint8_t held[8]; // Whole bytes read ahead, handed out by read_span().
+} PairReader;
+
+/*
+ * Gathers pairs into coded blocks for FLAG_ENTROPY streams, each block is:
+ *
+ *   type            1 bit, 0 for plain, 1 for Huffman
+ *   count           CODER_COUNT bits, pairs in the block, 1 to CODER_BLOCK
+ *   tables          Huffman only: LENGTH_BITS code length of each of the
+ *                   HUFF_SYMS values of a code's top CODE_HIGH bits, then,
+ *                   unless the stream is LZW, of each symbol
+ *   pairs           plain: each pair as write_pair() writes it, Huffman:
+ *                   the code of the pair's top bits, the bits below them
+ *                   as they are, then the code of its symbol
+ *
+ * Codes are as wide as they are without FLAG_ENTROPY, a code of CODE_HIGH
+ * bits or fewer is all top bits. A block is Huffman coded when that takes
+ * fewer bits than plain pairs, tables included. The encoder ends a block
+ * after each STOP_CODE and at each reset noted in the seek index, so the
+ * codes after either start a block of their own.
+ */
+typedef struct PairCoder {
+    uint32_t codes[CODER_BLOCK];
+    uint8_t syms[CODER_BLOCK];
+    uint8_t widths[CODER_BLOCK]; // Code width of each pair.
+    int count;
+    bool lzw; // Codes only, the symbols are left out.
+} PairCoder;
+
+/*
+ * Reads the coded blocks of a PairCoder, a block at a time
+ * Zeroed, it's ready for the first block
+ */
+typedef struct PairDecoder {
+    uint32_t left; // Pairs of the block still to come, 0 before the next block.
+    uint32_t count; // Pairs of the block being read.
+    int want; // Code lengths of the block's tables, 0 once they're all in.
+    int got; // Code lengths read so far.
+    bool plain; // Pairs as write_pair() writes them, no tables.
+    bool corrupt; // A block that can't be right.
+    uint8_t lens[2 * HUFF_SYMS];
+    uint16_t high[HUFF_TABLE]; // Decoding table of the codes' top bits.
+    uint16_t syms[HUFF_TABLE]; // Decoding table of the symbols.
+} PairDecoder;
+
+/*
+ * Buffers the symbols of decoded words, handing whole blocks to its sink
+ */
+typedef struct WordWriter {
+    uint8_t buff[BLOCK];
+    int index;
+    uint8_t *spill; // For words longer than a block.
+    uint32_t spill_size;
+    uint64_t total_syms;
+    Sink sink;
+    void *ctx;
+    bool error;
+} WordWriter;
+
 int read_bytes(int infile, uint8_t *buf, int to_read);
 
 int write_bytes(int outfile, uint8_t *buf, int to_write);
 
-void read_header(int infile, FileHeader *header);
+/*
+ * Writes all of buf[0..len) at offset of outfile without moving its file
+ * offset, so workers can fill in a regular file out of order
+ * Returns false if it couldn't all be written
+ */
+bool write_at(int outfile, const uint8_t *buf, size_t len, uint64_t offset);
+
+/*
+ * Maps the rest of infile, from its current offset, for sequential reading
+ * Returns false if infile isn't a non-empty regular file or can't be mapped,
+ * in which case it should be read with read_bytes()
+ * On success map->data[0..map->len) is the input from the current offset
+ */
+bool map_file(int infile, Mapping *map);
+
+/*
+ * Unmaps what map_file() mapped
+ */
+void unmap_file(Mapping *map);
+
+/*
+ * Returns a monotonic clock reading in nanoseconds, for timing phases
+ */
+uint64_t clock_ns(void);
+
+/*
+ * Sink that writes to the file descriptor pointed to by ctx
+ */
+bool fd_sink(void *ctx, const uint8_t *buf, size_t len);
+
+/*
+ * Sink that drops its input, for checking streams without writing them
+ */
+bool null_sink(void *ctx, const uint8_t *buf, size_t len);
+
+/*
+ * Sink that times the TimedSink pointed to by ctx
+ */
+bool timed_sink(void *ctx, const uint8_t *buf, size_t len);
+
+/*
+ * Sink that appends to the Buffer pointed to by ctx
+ */
+bool buffer_sink(void *ctx, const uint8_t *buf, size_t len);
+
+/*
+ * Grows buf to hold at least cap bytes, so appending up to them won't move it
+ * Returns false if out of memory, buf is left as it was
+ */
+bool buffer_reserve(Buffer *buf, size_t cap);
+
+/*
+ * Reserves disk for the first len bytes of outfile ahead of writing them,
+ * without changing its size, so the file is laid out in one go
+ * A hint: does nothing for pipes, terminals or file systems without support
+ */
+void preallocate(int outfile, uint64_t len);
+
+/*
+ * Gives back disk preallocate() reserved past the end of outfile, for output
+ * that failed before reaching the length it was reserved for
+ * Returns false if outfile isn't a regular file or couldn't be truncated
+ */
+bool release_preallocated(int outfile);
+
+/*
+ * Returns the bytes of infile from its current offset to its end,
+ * UINT64_MAX if it isn't a regular file
+ */
+uint64_t file_left(int infile);
+
+/*
+ * Decodes a header from the HEADER_SIZE bytes at buf
+ * length is left at 0, it's read from the bytes after them
+ */
+void read_header(const uint8_t *buf, FileHeader *header);
+
+/*
+ * Returns the bytes taken by the whole of a stream header with these flags
+ */
+int header_size(uint8_t flags);
+
+/*
+ * Encodes a header into the HEADER_SIZE bytes at buf
+ */
+void write_header(uint8_t *buf, FileHeader *header);
+
+void pw_init(PairWriter *pw, Sink sink, void *ctx);
+
+void write_pair(PairWriter *pw, uint32_t code, uint8_t sym, int bitlen);
+
+/*
+ * Writes a bitlen bit code without a symbol, for FLAG_LZW streams
+ */
+void write_code(PairWriter *pw, uint32_t code, int bitlen);
+
+/*
+ * Writes n pairs of codes[i] and syms[i], all with bitlen bit codes, as n
+ * calls of write_pair() would, or n codes alone if syms is NULL
+ */
+void write_pairs(PairWriter *pw, const uint32_t *codes, const uint8_t *syms, int n, int bitlen);
+
+void flush_pairs(PairWriter *pw);
+
+/*
+ * Pads the pairs written so far out to a whole byte and hands them to the
+ * sink, followed by the len bytes at buf straight from where they are
+ */
+void write_raw(PairWriter *pw, const uint8_t *buf, size_t len);
+
+/*
+ * Pads the pairs written so far out to a whole byte and appends the len
+ * bytes at buf, len at most 8
+ */
+void write_tail(PairWriter *pw, const uint8_t *buf, int len);
+
+void pc_init(PairCoder *pc, bool lzw);
+
+/*
+ * Adds a pair of bitlen bit code and sym to the block, sym is left out of
+ * LZW blocks, writing the block to pw once it's full
+ */
+void code_pair(PairCoder *pc, PairWriter *pw, uint32_t code, uint8_t sym, int bitlen);
+
+/*
+ * Adds n pairs as n calls of code_pair() would, syms is NULL for LZW blocks
+ */
+void code_pairs(
+    PairCoder *pc, PairWriter *pw, const uint32_t *codes, const uint8_t *syms, int n, int bitlen);
+
+/*
+ * Writes the pairs added so far to pw as a block, if there are any
+ */
+void flush_coder(PairCoder *pc, PairWriter *pw);
+
+void pr_init(PairReader *pr);
+
+/*
+ * Hands the span buf[0..len) to pr, it is read until the next call
+ */
+void pr_feed(PairReader *pr, const uint8_t *buf, size_t len);
+
+/*
+ * Reads a pair of bitlen bit code and 8 bit symbol
+ * Returns false if the input fed so far ends before the pair does
+ */
+bool read_pair(PairReader *pr, uint32_t *code, uint8_t *sym, int bitlen);
+
+/*
+ * Reads a bitlen bit code without a symbol, for FLAG_LZW streams
+ * Returns false if the input fed so far ends before the code does
+ */
+bool read_code(PairReader *pr, uint32_t *code, int bitlen);
+
+/*
+ * Reads a pair of bitlen bit code and symbol from the coded blocks of a
+ * FLAG_ENTROPY stream, a code alone if sym is NULL
+ * Returns false if the input fed so far ends before the pair does, or if
+ * the block can't be right, which sets pd->corrupt
+ */
+bool read_coded(PairReader *pr, PairDecoder *pd, uint32_t *code, uint8_t *sym, int bitlen);
 
-void write_header(int outfile, FileHeader *header);
+/*
+ * Skips the padding after the last pair read and reads up to len bytes
+ * Returns the bytes read, fewer than len if the input fed so far ends first
+ */
+int read_tail(PairReader *pr, uint8_t *buf, int len);
 
-bool read_sym(int infile, uint8_t *sym);
+/*
+ * Skips the padding after the last pair read and points *span at up to len
+ * bytes, straight in the input fed so far where possible
+ * The span is valid until the next call on pr
+ * Returns the bytes in the span, 0 if the input fed so far has run out
+ */
+size_t read_span(PairReader *pr, const uint8_t **span, size_t len);
 
-void write_pair(int outfile, uint16_t code, uint8_t sym, int bitlen);
+void ww_init(WordWriter *ww, Sink sink, void *ctx);
 
-void flush_pairs(int outfile);
+void ww_free(WordWriter *ww);
 
-bool read_pair(int infile, uint16_t *code, uint8_t *sym, int bitlen);
+void write_word(WordWriter *ww, WordTable *wt, uint32_t code);
 
-void write_word(int outfile, Word *w);
+/*
+ * Writes the len symbols at buf, a span that doesn't fit the buffer goes
+ * straight to the sink after what's buffered
+ */
+void write_syms(WordWriter *ww, const uint8_t *buf, size_t len);
 
-void flush_words(int outfile);
+void flush_words(WordWriter *ww);
 
 #endif
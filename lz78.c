@@ -0,0 +1,1755 @@
+#include "lz78.h"
+#include "code.h"
+#include "crc32c.h"
+#include "endian.h"
+#include "hash.h"
+#include "io.h"
+#include "profile.h"
+#include "trie.h"
+#include "word.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// pair sizes of the current and best windows of a frozen dictionary, see adapt()
+typedef struct Window {
+    uint64_t bits;
+    uint64_t syms;
+    uint64_t best_bits;
+    uint64_t best_syms;
+} Window;
+
+// what a decoder reads next, stored blocks only come in FLAG_STORED streams
+typedef enum Stage {
+    STAGE_CODES = 0, // Pairs, or LZW codes, up to a STOP_CODE.
+    STAGE_BLOCK, // LZW: the block type after a STOP_CODE.
+    STAGE_SIZE, // Length of a stored block.
+    STAGE_STORED, // Bytes of a stored block.
+} Stage;
+
+struct LZ78Dict {
+    uint32_t id;
+    uint32_t count;
+    uint32_t *prefix;
+    uint8_t *sym;
+};
+
+struct LZ78Encoder {
+    PairWriter pw;
+    PairCoder *coder; // Gathers the pairs into coded blocks, NULL to write them as they are.
+    const LZ78Dict *dict;
+    TrieNode **primed; // Node of each dictionary entry, indexed from START_CODE.
+    uint32_t base_code; // First code after the dictionary entries.
+    LZ78Engine engine;
+    TrieNode *root; // Trie engine.
+    TrieNode *curr_node;
+    HashTable *table; // Hash engine.
+    uint32_t curr_code; // Code of the phrase matched so far.
+    uint32_t prev_code;
+    uint32_t next_code;
+    int bits;
+    uint32_t max_code;
+    uint8_t prev_sym;
+    uint64_t total_syms;
+    uint64_t length; // Input length recorded in the header, LZ78_UNKNOWN_LENGTH if none.
+    bool checksum;
+    uint32_t crc; // CRC32C of the input so far.
+    uint32_t phrase_len; // Symbols matched since the last pair.
+    bool lzw; // Codes only, see LZ78_LZW.
+    uint32_t cuts; // Shorter phrases tried by flexible parsing, 0 to parse greedily.
+    uint8_t *ahead; // Input waiting for LOOK_WINDOW bytes after it, 2 * LOOK_WINDOW bytes.
+    uint32_t ahead_len;
+    uint32_t ahead_pos; // Start of the next phrase in ahead.
+    uint32_t *path; // Code of each prefix of the longest match, LOOK_MATCH + 1 of them.
+    bool stored; // Blocks are judged and may be stored, see STORED_BLOCK.
+    LZ78Encoder *trial; // Codes blocks on their own to judge them, made on first use.
+    uint8_t *block; // Input of the block being gathered, STORED_BLOCK bytes.
+    uint32_t block_len;
+    uint64_t stored_syms; // Input sent in stored blocks.
+    uint64_t coded_syms; // Input the codes and stored blocks written so far stand for.
+    bool index; // Resets are noted for the seek index, see MAGIC_INDEX.
+    uint8_t *syncs; // Index entries of the resets so far.
+    uint32_t sync_count;
+    uint32_t sync_cap;
+    LZ78Policy policy;
+    bool frozen; // Dictionary is full and no longer grows.
+    Window window;
+    uint64_t resets;
+    uint64_t phrase_lens[PHRASE_BUCKETS];
+    uint64_t code_widths[MAX_BITS + 1];
+    bool finished;
+    LZ78Status status;
+};
+
+struct LZ78Decoder {
+    PairReader pr;
+    PairDecoder coded; // Blocks of a FLAG_ENTROPY stream.
+    bool entropy; // Pairs come in coded blocks, see FLAG_ENTROPY.
+    WordWriter ww;
+    Sink sink; // Where the word writer's output goes once checksummed.
+    void *ctx;
+    const LZ78Phrases *phrases; // Takes the words instead of the sink, NULL to write them.
+    FileHeader header;
+    uint8_t head[HEADER_MAX]; // Header bytes gathered so far.
+    int head_len;
+    int head_size; // Header bytes expected, known once the flags are in.
+    bool ready; // Header read and table set up.
+    const LZ78Dict *dict;
+    uint32_t base_code; // First code after the dictionary entries.
+    WordTable *table;
+    uint32_t table_size; // Entries the table has room for, it outlives restarts.
+    uint32_t next_code;
+    uint32_t max_code;
+    bool lzw; // Codes only, see LZ78_LZW.
+    uint32_t prev_code; // LZW: code of the last word.
+    bool pending; // LZW: the last word's entry, next_code - 1, waits for the next word.
+    LZ78Policy policy;
+    bool frozen; // Dictionary is full and no longer grows.
+    Window window;
+    uint64_t resets;
+    uint64_t phrase_lens[PHRASE_BUCKETS];
+    uint64_t code_widths[MAX_BITS + 1];
+    uint32_t crc; // CRC32C of the output so far.
+    uint8_t tail[CRC_SIZE]; // Checksum bytes gathered after the STOP_CODE.
+    int tail_len;
+    Stage stage;
+    uint8_t size[STORED_SIZE]; // Length bytes of the stored block gathered so far.
+    int size_len;
+    uint32_t stored_left; // Bytes of the stored block still to come.
+    uint64_t stored_syms; // Output copied from stored blocks.
+    bool seeked; // Started at a reset, see lz78_decoder_seek().
+    uint64_t seek_syms; // Output expected from the reset to the next one.
+    int skip; // Bits of the first byte fed that belong ahead of the reset.
+    bool stopped; // STOP_CODE of BLOCK_END seen.
+    bool done; // STOP_CODE and checksum seen.
+    bool finished;
+    LZ78Status status;
+};
+
+// default options for an encoder
+LZ78Options lz78_default_options(void) {
+    LZ78Options opts = { 0 };
+    opts.bits = DEFAULT_BITS;
+    opts.protection = 0644;
+    opts.policy = LZ78_RESET;
+    opts.engine = LZ78_DEFAULT_ENGINE;
+    opts.checksum = true;
+    opts.length = LZ78_UNKNOWN_LENGTH;
+    opts.level = LZ78_DEFAULT_LEVEL;
+    opts.stored = true;
+    opts.index = false;
+    opts.entropy = false;
+    return opts;
+}
+
+// describe a status
+const char *lz78_strerror(LZ78Status status) {
+    switch (status) {
+    case LZ78_OK: return "Success";
+    case LZ78_ERR_MEMORY: return "Out of memory";
+    case LZ78_ERR_SINK: return "Couldn't write output";
+    case LZ78_ERR_MAGIC: return "Magic number does not match";
+    case LZ78_ERR_BITS: return "Unsupported dictionary code width";
+    case LZ78_ERR_CORRUPT: return "Corrupt input, code is not in the dictionary";
+    case LZ78_ERR_TRUNCATED: return "Input ends before the end of the stream";
+    case LZ78_ERR_STATE: return "Stream already finished";
+    case LZ78_ERR_FLAGS: return "Stream uses unsupported features";
+    case LZ78_ERR_DICT: return "Dictionary is missing or doesn't match";
+    case LZ78_ERR_CHECKSUM: return "Checksum does not match, input is corrupt";
+    case LZ78_ERR_INPUT: return "Couldn't read input";
+    case LZ78_ERR_LENGTH: return "Length does not match the header";
+    case LZ78_ERR_INDEX: return "Seek index is missing or doesn't match the stream";
+    }
+    return "Unknown error";
+}
+
+// FNV-1a over a span of bytes
+static uint32_t fnv1a(const uint8_t *buf, size_t len) {
+    uint32_t hash = 0x811C9DC5;
+    for (size_t i = 0; i < len; i += 1) {
+        hash = (hash ^ buf[i]) * 0x01000193;
+    }
+    return hash;
+}
+
+// constructor for a dictionary
+LZ78Dict *lz78_dict_load(const uint8_t *buf, size_t len) {
+    if (len < DICT_HEAD_SIZE || load_le32(buf) != DICT_MAGIC) {
+        return NULL;
+    }
+    uint32_t count = load_le32(buf + 8);
+    const uint8_t *entries = buf + DICT_HEAD_SIZE;
+    if ((len - DICT_HEAD_SIZE) / DICT_ENTRY_SIZE != count
+        || (len - DICT_HEAD_SIZE) % DICT_ENTRY_SIZE != 0 || count > MAX_CODE(MAX_BITS)
+        || load_le32(buf + 4) != fnv1a(entries, len - DICT_HEAD_SIZE)) {
+        return NULL;
+    }
+    LZ78Dict *dict = calloc(1, sizeof(LZ78Dict));
+    if (!dict) {
+        return NULL;
+    }
+    dict->id = load_le32(buf + 4);
+    dict->count = count;
+    dict->prefix = malloc((count ? count : 1) * sizeof(uint32_t));
+    dict->sym = malloc(count ? count : 1);
+    if (!dict->prefix || !dict->sym) {
+        lz78_dict_delete(dict);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < count; i += 1) {
+        dict->prefix[i] = load_le32(entries + (size_t) i * DICT_ENTRY_SIZE);
+        dict->sym[i] = entries[(size_t) i * DICT_ENTRY_SIZE + 4];
+        // every entry extends an earlier one
+        if (dict->prefix[i] != EMPTY_CODE
+            && (dict->prefix[i] < START_CODE || dict->prefix[i] >= START_CODE + i)) {
+            lz78_dict_delete(dict);
+            return NULL;
+        }
+    }
+    return dict;
+}
+
+// load a dictionary file
+LZ78Dict *lz78_dict_read(int infile) {
+    Mapping map;
+    if (map_file(infile, &map)) {
+        LZ78Dict *dict = lz78_dict_load(map.data, map.len);
+        unmap_file(&map);
+        return dict;
+    }
+    // not a regular file, read all of it in
+    Buffer in = { 0 };
+    uint8_t block[BLOCK];
+    int bytes_read = 0;
+    while ((bytes_read = read_bytes(infile, block, BLOCK)) > 0) {
+        if (!buffer_sink(&in, block, bytes_read)) {
+            free(in.data);
+            return NULL;
+        }
+    }
+    LZ78Dict *dict = lz78_dict_load(in.data, in.len);
+    free(in.data);
+    return dict;
+}
+
+uint32_t lz78_dict_id(const LZ78Dict *dict) {
+    return dict->id;
+}
+
+uint32_t lz78_dict_entries(const LZ78Dict *dict) {
+    return dict->count;
+}
+
+// check a dictionary leaves at least two codes to grow into
+bool lz78_dict_fits(const LZ78Dict *dict, int bits) {
+    return (uint64_t) START_CODE + dict->count + 2 <= MAX_CODE(bits);
+}
+
+// destructor for a dictionary
+void lz78_dict_delete(LZ78Dict *dict) {
+    if (dict) {
+        free(dict->prefix);
+        free(dict->sym);
+        free(dict);
+    }
+}
+
+// a trie node picked for a trained dictionary
+typedef struct Pick {
+    uint32_t code;
+    uint32_t uses;
+} Pick;
+
+// most used first, ties in code order so prefixes come before what extends them
+static int by_uses(const void *a, const void *b) {
+    const Pick *x = a;
+    const Pick *y = b;
+    if (x->uses != y->uses) {
+        return x->uses > y->uses ? -1 : 1;
+    }
+    return x->code < y->code ? -1 : x->code > y->code;
+}
+
+// in code order
+static int by_code(const void *a, const void *b) {
+    const Pick *x = a;
+    const Pick *y = b;
+    return x->code < y->code ? -1 : x->code > y->code;
+}
+
+// train a dictionary on samples
+LZ78Status lz78_dict_train(const uint8_t *const *samples, const size_t *lens, size_t n,
+    uint32_t entries, uint8_t **dst, size_t *dst_len) {
+    // codes of a MAX_BITS dictionary, minus reserved codes and room to grow
+    uint32_t limit = MAX_CODE(MAX_BITS) - 2;
+    if (entries > limit - START_CODE) {
+        entries = limit - START_CODE;
+    }
+    TrieNode *root = trie_create();
+    // per code: parent code, symbol and times the phrase was matched
+    uint32_t *parent = malloc((size_t) limit * sizeof(uint32_t));
+    uint8_t *sym = malloc(limit);
+    Pick *picks = malloc((size_t) limit * sizeof(Pick));
+    if (!root || !parent || !sym || !picks) {
+        trie_delete(root);
+        free(parent);
+        free(sym);
+        free(picks);
+        return LZ78_ERR_MEMORY;
+    }
+    LZ78Status status = LZ78_OK;
+    uint32_t next_code = START_CODE;
+    for (size_t s = 0; s < n && status == LZ78_OK; s += 1) {
+        // each sample starts from the root like a stream of its own
+        TrieNode *curr = root;
+        for (size_t i = 0; i < lens[s]; i += 1) {
+            TrieNode *next = trie_step(curr, samples[s][i]);
+            if (next) {
+                picks[next->code].uses += 1;
+                curr = next;
+                continue;
+            }
+            if (next_code < limit) {
+                if (!trie_insert(root, curr, samples[s][i], next_code)) {
+                    status = LZ78_ERR_MEMORY;
+                    break;
+                }
+                parent[next_code] = curr->code;
+                sym[next_code] = samples[s][i];
+                picks[next_code].code = next_code;
+                picks[next_code].uses = 1;
+                next_code += 1;
+            }
+            curr = root;
+        }
+    }
+    trie_delete(root);
+
+    // a phrase is matched at least as often as any phrase extending it, so the
+    // most used ones include their prefixes
+    uint32_t total = next_code - START_CODE;
+    qsort(picks + START_CODE, total, sizeof(Pick), by_uses);
+    uint32_t count = total < entries ? total : entries;
+    qsort(picks + START_CODE, count, sizeof(Pick), by_code);
+
+    size_t len = DICT_HEAD_SIZE + (size_t) count * DICT_ENTRY_SIZE;
+    uint8_t *out = status == LZ78_OK ? malloc(len) : NULL;
+    if (status == LZ78_OK && !out) {
+        status = LZ78_ERR_MEMORY;
+    }
+    if (status == LZ78_OK) {
+        // renumber the kept codes from START_CODE, reusing parent as the map
+        uint8_t *entry = out + DICT_HEAD_SIZE;
+        for (uint32_t i = 0; i < count; i += 1) {
+            uint32_t code = picks[START_CODE + i].code;
+            uint32_t prefix = parent[code] == EMPTY_CODE ? EMPTY_CODE : parent[parent[code]];
+            store_le32(entry, prefix);
+            entry[4] = sym[code];
+            entry += DICT_ENTRY_SIZE;
+            parent[code] = START_CODE + i;
+        }
+        store_le32(out, DICT_MAGIC);
+        store_le32(out + 4, fnv1a(out + DICT_HEAD_SIZE, len - DICT_HEAD_SIZE));
+        store_le32(out + 8, count);
+        *dst = out;
+        *dst_len = len;
+    }
+    free(parent);
+    free(sym);
+    free(picks);
+    return status;
+}
+
+// insert the dictionary entries, or LZW's single symbols, into the fresh dictionary of an encoder
+static bool prime(LZ78Encoder *enc) {
+    if (enc->lzw) {
+        for (uint32_t sym = 0; sym < ALPHABET; sym += 1) {
+            bool added = enc->engine == LZ78_HASH
+                ? hash_insert(enc->table, EMPTY_CODE, sym, START_CODE + sym)
+                : trie_insert(enc->root, enc->root, sym, START_CODE + sym) != NULL;
+            if (!added) {
+                return false;
+            }
+        }
+        return true;
+    }
+    const LZ78Dict *dict = enc->dict;
+    if (enc->engine == LZ78_HASH) {
+        // entries are keyed by code, so they go straight in
+        for (uint32_t i = 0; i < dict->count; i += 1) {
+            if (!hash_insert(enc->table, dict->prefix[i], dict->sym[i], START_CODE + i)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    for (uint32_t i = 0; i < dict->count; i += 1) {
+        TrieNode *prefix
+            = dict->prefix[i] == EMPTY_CODE ? enc->root : enc->primed[dict->prefix[i] - START_CODE];
+        enc->primed[i] = trie_insert(enc->root, prefix, dict->sym[i], START_CODE + i);
+        if (!enc->primed[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// set up the per stream state of an encoder and write the header
+static void start_stream(
+    LZ78Encoder *enc, uint16_t protection, uint64_t length, Sink sink, void *ctx) {
+    enc->curr_node = enc->root;
+    enc->curr_code = EMPTY_CODE;
+    enc->length = length;
+    enc->status = LZ78_OK;
+
+    // header goes out ahead of the first pair
+    pw_init(&enc->pw, sink, ctx);
+    if (enc->coder) {
+        pc_init(enc->coder, enc->lzw);
+    }
+    FileHeader header = { 0 };
+    header.magic = MAGIC;
+    header.protection = protection;
+    header.bits = enc->bits;
+    header.flags = enc->policy | (enc->dict ? FLAG_DICT : 0) | (enc->checksum ? FLAG_CRC : 0)
+                   | (length != LZ78_UNKNOWN_LENGTH ? FLAG_SIZE : 0) | (enc->lzw ? FLAG_LZW : 0)
+                   | (enc->stored ? FLAG_STORED : 0) | (enc->coder ? FLAG_ENTROPY : 0);
+    write_header(enc->pw.buff, &header);
+    enc->pw.index += HEADER_SIZE;
+    // the dictionary ID follows so decoders can check they have the same one
+    if (enc->dict) {
+        store_le32(enc->pw.buff + enc->pw.index, enc->dict->id);
+        enc->pw.index += DICT_ID_SIZE;
+    }
+    // a known length lets decoders size their output up front
+    if (length != LZ78_UNKNOWN_LENGTH) {
+        store_le64(enc->pw.buff + enc->pw.index, length);
+        enc->pw.index += LENGTH_SIZE;
+    }
+    // add header bits to total
+    enc->pw.total_bits += enc->pw.index * 8;
+}
+
+// constructor for an encoder
+LZ78Encoder *lz78_encoder_create(const LZ78Options *opts, Sink sink, void *ctx) {
+    LZ78Options defaults = lz78_default_options();
+    if (!opts) {
+        opts = &defaults;
+    }
+    if (opts->bits < MIN_BITS || opts->bits > MAX_BITS || opts->policy < LZ78_RESET
+        || opts->policy > LZ78_ADAPTIVE || opts->engine < LZ78_TRIE || opts->engine > LZ78_HASH
+        || opts->level < LZ78_MIN_LEVEL || opts->level > LZ78_MAX_LEVEL
+        || opts->format < LZ78_PAIRS || opts->format > LZ78_LZW
+        || (opts->dict && (opts->format == LZ78_LZW || !lz78_dict_fits(opts->dict, opts->bits)))) {
+        return NULL;
+    }
+    LZ78Encoder *enc = calloc(1, sizeof(LZ78Encoder));
+    if (!enc) {
+        return NULL;
+    }
+    enc->engine = opts->engine;
+    if (enc->engine == LZ78_HASH) {
+        enc->table = hash_create();
+    } else {
+        enc->root = trie_create();
+    }
+    if (!enc->root && !enc->table) {
+        free(enc);
+        return NULL;
+    }
+    enc->dict = opts->dict;
+    enc->base_code = START_CODE;
+    if (enc->dict) {
+        // the dictionary starts out holding the pretrained entries, the trie
+        // finds their prefixes through the node of each
+        if (enc->engine == LZ78_TRIE) {
+            enc->primed = malloc((enc->dict->count ? enc->dict->count : 1) * sizeof(TrieNode *));
+        }
+        if ((enc->engine == LZ78_TRIE && !enc->primed) || !prime(enc)) {
+            lz78_encoder_delete(enc);
+            return NULL;
+        }
+        enc->base_code += enc->dict->count;
+    }
+    // LZW starts from every single symbol
+    enc->lzw = opts->format == LZ78_LZW;
+    if (enc->lzw) {
+        if (!prime(enc)) {
+            lz78_encoder_delete(enc);
+            return NULL;
+        }
+        enc->base_code += ALPHABET;
+    }
+    enc->next_code = enc->base_code;
+    enc->bits = opts->bits;
+    enc->max_code = MAX_CODE(opts->bits);
+    enc->policy = opts->policy;
+    enc->checksum = opts->checksum;
+    // flexible parsing looks ahead through a window of its own, a dictionary
+    // that resets is never frozen so it's greedy whatever the level
+    // LZW phrases are always parsed greedily
+    enc->cuts = opts->policy == LZ78_RESET || enc->lzw ? 0 : LEVEL_CUTS(opts->level);
+    if (enc->cuts) {
+        enc->ahead = malloc(2 * LOOK_WINDOW);
+        enc->path = malloc((LOOK_MATCH + 1) * sizeof(uint32_t));
+        if (!enc->ahead || !enc->path) {
+            lz78_encoder_delete(enc);
+            return NULL;
+        }
+    }
+    // input is gathered into whole blocks to judge, unless it comes in them
+    enc->stored = opts->stored;
+    if (enc->stored) {
+        enc->block = malloc(STORED_BLOCK);
+        if (!enc->block) {
+            lz78_encoder_delete(enc);
+            return NULL;
+        }
+    }
+    enc->index = opts->index;
+    if (opts->entropy) {
+        enc->coder = malloc(sizeof(PairCoder));
+        if (!enc->coder) {
+            lz78_encoder_delete(enc);
+            return NULL;
+        }
+    }
+    start_stream(enc, opts->protection, opts->length, sink, ctx);
+    return enc;
+}
+
+// note a pair of a frozen dictionary in the current window
+// returns true once a whole window compresses worse than the best one by more than ADAPT_SLACK
+static bool adapt(Window *w, int bits, uint32_t syms) {
+    w->bits += bits;
+    w->syms += syms;
+    if (w->syms < ADAPT_WINDOW) {
+        return false;
+    }
+    // compare bits per symbol without dividing, both sides must agree exactly
+    bool worse = false;
+    if (!w->best_syms || w->bits * w->best_syms < w->best_bits * w->syms) {
+        w->best_bits = w->bits;
+        w->best_syms = w->syms;
+    } else {
+        worse = w->bits * w->best_syms * 100 > w->best_bits * w->syms * (100 + ADAPT_SLACK);
+    }
+    w->bits = 0;
+    w->syms = 0;
+    return worse;
+}
+
+// note a reset in the seek index, the next code is where decoding can start over
+static void add_sync(LZ78Encoder *enc) {
+    if (enc->sync_count == enc->sync_cap) {
+        uint32_t cap = enc->sync_cap ? enc->sync_cap * 2 : 64;
+        uint8_t *grown = realloc(enc->syncs, (size_t) cap * INDEX_ENTRY_SIZE);
+        if (!grown) {
+            enc->status = LZ78_ERR_MEMORY;
+            return;
+        }
+        enc->syncs = grown;
+        enc->sync_cap = cap;
+    }
+    // decoding starts over on a block of its own
+    if (enc->coder) {
+        flush_coder(enc->coder, &enc->pw);
+    }
+    uint8_t *entry = enc->syncs + (size_t) enc->sync_count * INDEX_ENTRY_SIZE;
+    store_le64(entry, enc->pw.total_bits);
+    store_le64(entry + 8, enc->coded_syms);
+    enc->sync_count += 1;
+}
+
+// reset the dictionary to just root, or root and the pretrained entries
+static void encoder_reset(LZ78Encoder *enc) {
+    enc->next_code = enc->base_code;
+    if (enc->engine == LZ78_HASH) {
+        hash_reset(enc->table);
+    } else {
+        trie_reset(enc->root);
+    }
+    if ((enc->dict || enc->lzw) && !prime(enc)) {
+        enc->status = LZ78_ERR_MEMORY;
+    }
+    enc->frozen = false;
+    enc->resets += 1;
+    if (enc->index) {
+        add_sync(enc);
+    }
+}
+
+// start a new stream on an encoder, keeping its dictionary's memory
+LZ78Status lz78_encoder_restart(
+    LZ78Encoder *enc, uint16_t protection, uint64_t length, Sink sink, void *ctx) {
+    // only the memory is kept, the dictionary starts over
+    enc->status = LZ78_OK;
+    encoder_reset(enc);
+    enc->total_syms = 0;
+    enc->crc = 0;
+    enc->phrase_len = 0;
+    enc->ahead_len = 0;
+    enc->ahead_pos = 0;
+    enc->block_len = 0;
+    enc->stored_syms = 0;
+    enc->coded_syms = 0;
+    enc->sync_count = 0;
+    memset(&enc->window, 0, sizeof(Window));
+    enc->resets = 0;
+    memset(enc->phrase_lens, 0, sizeof(enc->phrase_lens));
+    memset(enc->code_widths, 0, sizeof(enc->code_widths));
+    enc->finished = false;
+    LZ78Status status = enc->status;
+    start_stream(enc, protection, length, sink, ctx);
+    // a failed re-prime leaves the dictionary unusable
+    enc->status = status;
+    return status;
+}
+
+// move on after a pair of bitlen bit code: the dictionary grew, filled up or was judged
+static inline void encoder_advance(LZ78Encoder *enc, int bitlen, uint32_t len) {
+    enc->coded_syms += len;
+    if (enc->frozen) {
+        if (enc->policy == LZ78_ADAPTIVE && adapt(&enc->window, bitlen + (enc->lzw ? 0 : 8), len)) {
+            encoder_reset(enc);
+        }
+        return;
+    }
+    // inc next available code
+    enc->next_code += 1;
+    // if we're at max code
+    if (enc->next_code == enc->max_code) {
+        if (enc->policy == LZ78_RESET) {
+            // reached max code, reset code and trie
+            encoder_reset(enc);
+        } else {
+            // keep the full dictionary, codes stay max_code wide
+            enc->frozen = true;
+            memset(&enc->window, 0, sizeof(Window));
+        }
+    }
+}
+
+// write a pair, or an LZW code without its symbol, through the coder if there is one
+static inline void send_pair(LZ78Encoder *enc, uint32_t code, uint8_t sym, int bitlen) {
+    if (enc->coder) {
+        code_pair(enc->coder, &enc->pw, code, sym, bitlen);
+    } else if (enc->lzw) {
+        write_code(&enc->pw, code, bitlen);
+    } else {
+        write_pair(&enc->pw, code, sym, bitlen);
+    }
+}
+
+// pairs of one code width on their way to the pair writer
+typedef struct PairBatch {
+    uint32_t codes[PAIR_BATCH];
+    uint8_t syms[PAIR_BATCH];
+    int count;
+    int bitlen;
+} PairBatch;
+
+// hand the batched pairs, or LZW codes, to the pair writer
+static inline void flush_batch(LZ78Encoder *enc, PairBatch *batch, bool lzw) {
+    if (batch->count) {
+        const uint8_t *syms = lzw ? NULL : batch->syms;
+        if (enc->coder) {
+            code_pairs(enc->coder, &enc->pw, batch->codes, syms, batch->count, batch->bitlen);
+        } else {
+            write_pairs(&enc->pw, batch->codes, syms, batch->count, batch->bitlen);
+        }
+        enc->code_widths[batch->bitlen] += batch->count;
+        batch->count = 0;
+    }
+}
+
+// compress a span of input greedily, engine and lzw are constants so each
+// combination gets a loop of its own
+// the match walks down the dictionary in locals, going back to enc only at
+// the end of the span, where the next span picks it up
+// an LZW miss writes out the code matched so far and its symbol starts the
+// next phrase, a pair takes the symbol with it
+// always inlined, a shared copy would test engine and lzw on every symbol
+__attribute__((always_inline)) static inline void encode_span(
+    LZ78Encoder *enc, const uint8_t *buf, size_t len, LZ78Engine engine, bool lzw) {
+    PROFILE(PROF_ENCODE_SPAN);
+    const uint8_t *p = buf;
+    const uint8_t *end = buf + len;
+    TrieNode *node = enc->curr_node;
+    uint32_t code = enc->curr_code;
+    uint32_t prev_code = enc->prev_code;
+    const uint8_t *start = p; // First symbol of the phrase in this span.
+    uint32_t carried = enc->phrase_len; // Symbols of the phrase from earlier spans.
+    PairBatch batch;
+    batch.count = 0;
+    batch.bitlen = get_bitlen(enc->next_code);
+    while (p < end && enc->status == LZ78_OK) {
+        // follow the phrase as far as the dictionary has it
+        if (engine == LZ78_HASH) {
+            uint32_t next = STOP_CODE;
+            while (p < end && (next = hash_step(enc->table, code, *p)) != STOP_CODE) {
+                prev_code = code;
+                code = next;
+                p += 1;
+            }
+        } else {
+            TrieNode *next = NULL;
+            while (p < end && (next = trie_step(node, *p)) != NULL) {
+                prev_code = code;
+                code = next->code;
+                node = next;
+                p += 1;
+            }
+        }
+        if (p == end) {
+            break;
+        }
+        // new phrase, out goes the pair of the match and the symbol that missed
+        uint8_t sym = *p;
+        uint32_t phrase_len = carried + (uint32_t) (p - start) + (lzw ? 0 : 1);
+        int bitlen = get_bitlen(enc->next_code);
+        if (batch.count == PAIR_BATCH || bitlen != batch.bitlen) {
+            flush_batch(enc, &batch, lzw);
+            batch.bitlen = bitlen;
+        }
+        batch.codes[batch.count] = code;
+        batch.syms[batch.count] = sym;
+        batch.count += 1;
+        enc->phrase_lens[get_bitlen(phrase_len) - 1] += 1;
+        // add the new phrase, unless the dictionary is frozen
+        if (!enc->frozen) {
+            bool added = engine == LZ78_HASH
+                ? hash_insert(enc->table, code, sym, enc->next_code)
+                : trie_insert(enc->root, node, sym, enc->next_code) != NULL;
+            if (!added) {
+                enc->status = LZ78_ERR_MEMORY;
+            }
+        }
+        // a reset notes in the index where the next code starts, the pairs ahead of it go first
+        bool resets = enc->frozen ? enc->policy == LZ78_ADAPTIVE
+                                  : enc->next_code + 1 == enc->max_code;
+        if (enc->index && resets) {
+            flush_batch(enc, &batch, lzw);
+        }
+        encoder_advance(enc, bitlen, phrase_len);
+        carried = 0;
+        if (lzw) {
+            // single symbols are always there, even right after a reset
+            code = START_CODE + sym;
+            node = engine == LZ78_HASH ? NULL : trie_step(enc->root, sym);
+            start = p;
+        } else {
+            code = EMPTY_CODE;
+            node = enc->root;
+            start = p + 1;
+        }
+        p += 1;
+    }
+    flush_batch(enc, &batch, lzw);
+    // the phrase in progress carries on in the next span
+    if (p > start) {
+        enc->prev_sym = p[-1];
+    }
+    enc->curr_node = node;
+    enc->curr_code = code;
+    enc->prev_code = prev_code;
+    enc->phrase_len = carried + (uint32_t) (p - start);
+}
+
+// length of the longest phrase of the dictionary at p, at most max symbols
+// path, if given, gets the code of each prefix and node the trie node of the match
+static inline uint32_t longest_match(LZ78Encoder *enc, const uint8_t *p, uint32_t max,
+    uint32_t *path, TrieNode **node, LZ78Engine engine) {
+    uint32_t code = EMPTY_CODE;
+    TrieNode *n = enc->root;
+    uint32_t len = 0;
+    if (path) {
+        path[0] = EMPTY_CODE;
+    }
+    while (len < max) {
+        if (engine == LZ78_HASH) {
+            code = hash_step(enc->table, code, p[len]);
+        } else {
+            TrieNode *next = trie_step(n, p[len]);
+            code = next ? next->code : STOP_CODE;
+            n = next ? next : n;
+        }
+        if (code == STOP_CODE) {
+            break;
+        }
+        len += 1;
+        if (path) {
+            path[len] = code;
+        }
+    }
+    if (node) {
+        *node = n;
+    }
+    return len;
+}
+
+// write out a phrase of len symbols, the phrase of code extended by sym
+// only a phrase that extends the longest match is new, any shorter one is
+// already in the dictionary and just uses up its code, as the decoder's copy does
+static inline void emit_phrase(LZ78Encoder *enc, uint32_t code, uint8_t sym, uint32_t len,
+    TrieNode *node, bool extends, LZ78Engine engine) {
+    int bitlen = get_bitlen(enc->next_code);
+    send_pair(enc, code, sym, bitlen);
+    enc->code_widths[bitlen] += 1;
+    enc->phrase_lens[get_bitlen(len) - 1] += 1;
+    if (!enc->frozen && extends) {
+        bool added = engine == LZ78_HASH
+            ? hash_insert(enc->table, code, sym, enc->next_code)
+            : trie_insert(enc->root, node, sym, enc->next_code) != NULL;
+        if (!added) {
+            enc->status = LZ78_ERR_MEMORY;
+        }
+    }
+    encoder_advance(enc, bitlen, len);
+}
+
+// pick and write out the phrase at data[0..len), returning the symbols it takes
+// a phrase cut l symbols into the longest match takes l + 1, the cut that lets
+// the next phrase reach furthest wins, ties going to the longer phrase
+static inline uint32_t parse_phrase(
+    LZ78Encoder *enc, const uint8_t *data, uint32_t len, LZ78Engine engine) {
+    TrieNode *node = NULL;
+    uint32_t match = longest_match(
+        enc, data, len < LOOK_MATCH ? len : LOOK_MATCH, enc->path, &node, engine);
+    if (match == len) {
+        // the rest of the input is a phrase, its last symbol goes in the pair
+        emit_phrase(enc, enc->path[match - 1], data[match - 1], match, node, false, engine);
+        return match;
+    }
+    uint32_t best = match;
+    uint64_t best_reach = 0;
+    // a growing dictionary needs every new phrase it can get, cuts wait for a frozen one
+    uint32_t cuts = enc->frozen ? enc->cuts : 0;
+    uint32_t lowest = match > cuts ? match - cuts : 0;
+    for (uint32_t cut = match + 1; cut-- > lowest;) {
+        uint32_t rest = len - cut - 1;
+        uint64_t reach = (uint64_t) cut + 1
+                         + longest_match(enc, data + cut + 1,
+                             rest < LOOK_MATCH ? rest : LOOK_MATCH, NULL, NULL, engine);
+        if (reach > best_reach) {
+            best = cut;
+            best_reach = reach;
+        }
+    }
+    emit_phrase(enc, enc->path[best], data[best], best + 1, node, best == match, engine);
+    return best + 1;
+}
+
+// compress a span of input by flexible parsing, phrases are parsed once
+// LOOK_WINDOW bytes follow them, so the parse doesn't depend on how input is split
+static void parse_ahead(LZ78Encoder *enc, const uint8_t *buf, size_t len, LZ78Engine engine) {
+    while (len > 0 && enc->status == LZ78_OK) {
+        uint32_t take = 2 * LOOK_WINDOW - enc->ahead_len;
+        if (take > len) {
+            take = len;
+        }
+        memcpy(enc->ahead + enc->ahead_len, buf, take);
+        enc->ahead_len += take;
+        buf += take;
+        len -= take;
+        while (enc->ahead_len - enc->ahead_pos >= LOOK_WINDOW && enc->status == LZ78_OK) {
+            enc->ahead_pos += parse_phrase(
+                enc, enc->ahead + enc->ahead_pos, enc->ahead_len - enc->ahead_pos, engine);
+        }
+        // less than a window is left, slide it to the front
+        memmove(enc->ahead, enc->ahead + enc->ahead_pos, enc->ahead_len - enc->ahead_pos);
+        enc->ahead_len -= enc->ahead_pos;
+        enc->ahead_pos = 0;
+    }
+}
+
+// compress a span of input with the parser the options chose
+static void code_span(LZ78Encoder *enc, const uint8_t *buf, size_t len) {
+    if (enc->cuts) {
+        if (enc->engine == LZ78_HASH) {
+            parse_ahead(enc, buf, len, LZ78_HASH);
+        } else {
+            parse_ahead(enc, buf, len, LZ78_TRIE);
+        }
+    } else if (enc->lzw) {
+        if (enc->engine == LZ78_HASH) {
+            encode_span(enc, buf, len, LZ78_HASH, true);
+        } else {
+            encode_span(enc, buf, len, LZ78_TRIE, true);
+        }
+    } else if (enc->engine == LZ78_HASH) {
+        encode_span(enc, buf, len, LZ78_HASH, false);
+    } else {
+        encode_span(enc, buf, len, LZ78_TRIE, false);
+    }
+}
+
+// code everything taken so far, the phrase in progress goes out as it is
+// the decoder grows, freezes or resets its table on it, as on any other
+static void end_phrase(LZ78Encoder *enc) {
+    // the last window of flexibly parsed input has nothing more to wait for
+    while (enc->ahead_pos < enc->ahead_len && enc->status == LZ78_OK) {
+        enc->ahead_pos += parse_phrase(enc, enc->ahead + enc->ahead_pos,
+            enc->ahead_len - enc->ahead_pos, enc->engine);
+    }
+    enc->ahead_len = 0;
+    enc->ahead_pos = 0;
+    // check if we're at root node, if not write out the prefix matched so far
+    if (enc->curr_code != EMPTY_CODE && enc->status == LZ78_OK) {
+        int bitlen = get_bitlen(enc->next_code);
+        if (enc->lzw) {
+            send_pair(enc, enc->curr_code, 0, bitlen);
+        } else {
+            send_pair(enc, enc->prev_code, enc->prev_sym, bitlen);
+        }
+        enc->code_widths[bitlen] += 1;
+        enc->phrase_lens[get_bitlen(enc->phrase_len) - 1] += 1;
+        encoder_advance(enc, bitlen, enc->phrase_len);
+    }
+    enc->curr_node = enc->root;
+    enc->curr_code = EMPTY_CODE;
+    enc->phrase_len = 0;
+}
+
+// stop the codes with STOP_CODE and bit_length of next_code, then the type
+// of block that follows when the stream has them
+// a coded block ends with the STOP_CODE, whatever follows goes after it
+static void write_stop(LZ78Encoder *enc, uint8_t block) {
+    int bitlen = get_bitlen(enc->next_code);
+    send_pair(enc, STOP_CODE, block, bitlen);
+    if (enc->coder) {
+        flush_coder(enc->coder, &enc->pw);
+    }
+    if (enc->lzw && enc->stored) {
+        write_code(&enc->pw, block, 8);
+    }
+    enc->code_widths[bitlen] += 1;
+}
+
+// log2 of x > 0 in 16.16 fixed point
+static uint32_t log2_fixed(uint32_t x) {
+    int whole = get_bitlen(x) - 1;
+    // x scaled to [1, 2) with 31 fraction bits, each squaring gives the next bit
+    uint64_t m = (uint64_t) x << (31 - whole);
+    uint32_t frac = 0;
+    for (int bit = 15; bit >= 0; bit -= 1) {
+        m = (m * m) >> 31;
+        if (m >= UINT64_C(1) << 32) {
+            m >>= 1;
+            frac |= UINT32_C(1) << bit;
+        }
+    }
+    return ((uint32_t) whole << 16) | frac;
+}
+
+// check if a block carries STORED_ENTROPY bits per byte or more
+static bool high_entropy(const uint8_t *buf, uint32_t len) {
+    // four histograms, so runs of one byte don't wait on the same counter
+    uint32_t counts[4][ALPHABET] = { { 0 } };
+    uint32_t i = 0;
+    for (; i + 4 <= len; i += 4) {
+        counts[0][buf[i]] += 1;
+        counts[1][buf[i + 1]] += 1;
+        counts[2][buf[i + 2]] += 1;
+        counts[3][buf[i + 3]] += 1;
+    }
+    for (; i < len; i += 1) {
+        counts[0][buf[i]] += 1;
+    }
+    // len times the entropy is len * log2(len) less count * log2(count) of each byte
+    uint64_t bits = (uint64_t) len * log2_fixed(len);
+    for (int sym = 0; sym < ALPHABET; sym += 1) {
+        uint32_t count = counts[0][sym] + counts[1][sym] + counts[2][sym] + counts[3][sym];
+        if (count) {
+            bits -= (uint64_t) count * log2_fixed(count);
+        }
+    }
+    return bits >= (uint64_t) len * (STORED_ENTROPY << 16);
+}
+
+// check if a block would come out larger as codes than stored
+// a block of high entropy bytes may still repeat, so it's coded on its own
+// by the trial encoder, anything else always compresses
+static bool incompressible(LZ78Encoder *enc, const uint8_t *buf, uint32_t len) {
+    if (!high_entropy(buf, len)) {
+        return false;
+    }
+    if (!enc->trial) {
+        LZ78Options opts = lz78_default_options();
+        opts.bits = enc->bits;
+        opts.policy = enc->policy;
+        opts.dict = enc->dict;
+        opts.engine = enc->engine;
+        opts.checksum = false;
+        opts.format = enc->lzw ? LZ78_LZW : LZ78_PAIRS;
+        opts.stored = false;
+        opts.entropy = enc->coder != NULL;
+        enc->trial = lz78_encoder_create(&opts, null_sink, NULL);
+        if (!enc->trial) {
+            enc->status = LZ78_ERR_MEMORY;
+            return false;
+        }
+    }
+    // the trial starts from a fresh dictionary each time, its header doesn't count
+    // it's fed a piece at a time and given up once it's past the stored size
+    LZ78Stats stats;
+    LZ78Status status = lz78_encoder_restart(enc->trial, 0, LZ78_UNKNOWN_LENGTH, null_sink, NULL);
+    lz78_encoder_stats(enc->trial, &stats);
+    uint64_t limit = stats.bits + ((uint64_t) len + STORED_SIZE) * 8;
+    for (uint32_t at = 0; at < len && status == LZ78_OK && stats.bits < limit; at += BLOCK) {
+        status = lz78_encoder_update(enc->trial, buf + at, len - at < BLOCK ? len - at : BLOCK);
+        lz78_encoder_stats(enc->trial, &stats);
+    }
+    if (status == LZ78_OK && stats.bits < limit) {
+        status = lz78_encoder_finish(enc->trial);
+        lz78_encoder_stats(enc->trial, &stats);
+    }
+    if (status != LZ78_OK) {
+        enc->status = status;
+        return false;
+    }
+    return stats.bits >= limit;
+}
+
+// code a block of input, or store it as it is if coding would only expand it
+static void take_block(LZ78Encoder *enc, const uint8_t *buf, uint32_t len) {
+    if (!incompressible(enc, buf, len)) {
+        code_span(enc, buf, len);
+        return;
+    }
+    end_phrase(enc);
+    if (enc->status != LZ78_OK) {
+        return;
+    }
+    write_stop(enc, BLOCK_STORED);
+    uint8_t size[STORED_SIZE];
+    store_le32(size, len);
+    write_tail(&enc->pw, size, STORED_SIZE);
+    write_raw(&enc->pw, buf, len);
+    enc->stored_syms += len;
+    enc->coded_syms += len;
+}
+
+// write the seek index of the resets after the end of the stream
+static void write_index(LZ78Encoder *enc) {
+    uint8_t count[4];
+    store_le32(count, enc->sync_count);
+    write_tail(&enc->pw, count, 4);
+    uint64_t offset = enc->pw.total_bits / 8 - 4;
+    uint8_t length[8];
+    store_le64(length, enc->total_syms);
+    write_tail(&enc->pw, length, 8);
+    write_raw(&enc->pw, enc->syncs, (size_t) enc->sync_count * INDEX_ENTRY_SIZE);
+    uint8_t footer[INDEX_FOOTER_SIZE];
+    store_le64(footer, offset);
+    store_le32(footer + 8, MAGIC_INDEX);
+    write_tail(&enc->pw, footer, 8);
+    write_tail(&enc->pw, footer + 8, 4);
+}
+
+// compress a span of input
+LZ78Status lz78_encoder_update(LZ78Encoder *enc, const uint8_t *buf, size_t len) {
+    if (enc->finished) {
+        return LZ78_ERR_STATE;
+    }
+    if (enc->checksum) {
+        enc->crc = crc32c(enc->crc, buf, len);
+    }
+    enc->total_syms += len;
+    if (!enc->stored) {
+        code_span(enc, buf, len);
+    }
+    // blocks start every STORED_BLOCK bytes however the input is split
+    while (enc->stored && len > 0 && enc->status == LZ78_OK) {
+        if (enc->block_len == 0 && len >= STORED_BLOCK) {
+            // a whole block is there already, judge it where it is
+            take_block(enc, buf, STORED_BLOCK);
+            buf += STORED_BLOCK;
+            len -= STORED_BLOCK;
+            continue;
+        }
+        uint32_t take = STORED_BLOCK - enc->block_len;
+        if (take > len) {
+            take = len;
+        }
+        memcpy(enc->block + enc->block_len, buf, take);
+        enc->block_len += take;
+        buf += take;
+        len -= take;
+        if (enc->block_len == STORED_BLOCK) {
+            take_block(enc, enc->block, STORED_BLOCK);
+            enc->block_len = 0;
+        }
+    }
+    if (enc->status == LZ78_OK && enc->pw.error) {
+        enc->status = LZ78_ERR_SINK;
+    }
+    return enc->status;
+}
+
+// end the stream
+LZ78Status lz78_encoder_finish(LZ78Encoder *enc) {
+    if (enc->finished) {
+        return LZ78_ERR_STATE;
+    }
+    enc->finished = true;
+    if (enc->status != LZ78_OK) {
+        return enc->status;
+    }
+    // the header already promised the length, input that changed since can't keep it
+    if (enc->length != LZ78_UNKNOWN_LENGTH && enc->total_syms != enc->length) {
+        enc->status = LZ78_ERR_LENGTH;
+        return enc->status;
+    }
+    // the last block is judged as it is, however short
+    if (enc->block_len > 0) {
+        take_block(enc, enc->block, enc->block_len);
+        enc->block_len = 0;
+    }
+    end_phrase(enc);
+    if (enc->status != LZ78_OK) {
+        return enc->status;
+    }
+    write_stop(enc, BLOCK_END);
+    // the checksum starts at the next whole byte
+    if (enc->checksum) {
+        uint8_t tail[CRC_SIZE];
+        store_le32(tail, enc->crc);
+        write_tail(&enc->pw, tail, CRC_SIZE);
+    }
+    if (enc->index) {
+        write_index(enc);
+    }
+    // flush any unwritten, buffered pairs
+    flush_pairs(&enc->pw);
+    if (enc->pw.error) {
+        enc->status = LZ78_ERR_SINK;
+    }
+    return enc->status;
+}
+
+// report encoder stats
+void lz78_encoder_stats(LZ78Encoder *enc, LZ78Stats *stats) {
+    memset(stats, 0, sizeof(LZ78Stats));
+    stats->syms = enc->total_syms;
+    stats->bits = enc->pw.total_bits;
+    stats->dict_bytes = enc->engine == LZ78_HASH ? hash_memory(enc->table) : trie_memory(enc->root);
+    // a dictionary that was reset has been full, codes EMPTY_CODE up to max_code
+    stats->entries = (enc->resets || enc->frozen ? enc->max_code : enc->next_code) - EMPTY_CODE;
+    stats->resets = enc->resets;
+    stats->stored = enc->stored_syms;
+    memcpy(stats->phrase_lens, enc->phrase_lens, sizeof(stats->phrase_lens));
+    memcpy(stats->code_widths, enc->code_widths, sizeof(stats->code_widths));
+}
+
+// destructor for an encoder
+void lz78_encoder_delete(LZ78Encoder *enc) {
+    if (enc) {
+        trie_delete(enc->root);
+        hash_delete(enc->table);
+        free(enc->primed);
+        free(enc->ahead);
+        free(enc->path);
+        free(enc->block);
+        free(enc->syncs);
+        free(enc->coder);
+        lz78_encoder_delete(enc->trial);
+        free(enc);
+    }
+}
+
+// sink between the word writer and the decoder's sink, adding output to the checksum
+static bool crc_sink(void *ctx, const uint8_t *buf, size_t len) {
+    LZ78Decoder *dec = ctx;
+    if (dec->header.flags & FLAG_CRC) {
+        dec->crc = crc32c(dec->crc, buf, len);
+    }
+    return dec->sink(dec->ctx, buf, len);
+}
+
+// set up the per stream state of a zeroed decoder
+static void start_decoding(LZ78Decoder *dec, Sink sink, void *ctx) {
+    pr_init(&dec->pr);
+    dec->sink = sink;
+    dec->ctx = ctx;
+    ww_init(&dec->ww, crc_sink, dec);
+    dec->head_size = HEADER_SIZE;
+    dec->next_code = START_CODE;
+    dec->status = LZ78_OK;
+}
+
+// constructor for a decoder
+LZ78Decoder *lz78_decoder_create(Sink sink, void *ctx) {
+    LZ78Decoder *dec = calloc(1, sizeof(LZ78Decoder));
+    if (!dec) {
+        return NULL;
+    }
+    start_decoding(dec, sink, ctx);
+    return dec;
+}
+
+// start a new stream on a decoder, keeping its table and spill buffer
+void lz78_decoder_restart(LZ78Decoder *dec, Sink sink, void *ctx) {
+    WordTable *table = dec->table;
+    uint32_t table_size = dec->table_size;
+    const LZ78Dict *dict = dec->dict;
+    const LZ78Phrases *phrases = dec->phrases;
+    uint8_t *spill = dec->ww.spill;
+    uint32_t spill_size = dec->ww.spill_size;
+    memset(dec, 0, sizeof(LZ78Decoder));
+    start_decoding(dec, sink, ctx);
+    dec->table = table;
+    dec->table_size = table_size;
+    dec->dict = dict;
+    dec->phrases = phrases;
+    dec->ww.spill = spill;
+    dec->ww.spill_size = spill_size;
+}
+
+// check the fixed header, noting which optional fields follow it
+static void check_header(LZ78Decoder *dec) {
+    read_header(dec->head, &dec->header);
+    // verify magic number
+    if (dec->header.magic != MAGIC) {
+        dec->status = LZ78_ERR_MAGIC;
+        return;
+    }
+    // files from before the code width was recorded use 16 bit codes
+    int bits = dec->header.bits ? dec->header.bits : DEFAULT_BITS;
+    if (bits < MIN_BITS || bits > MAX_BITS) {
+        dec->status = LZ78_ERR_BITS;
+        return;
+    }
+    if (dec->header.flags & ~FLAGS_KNOWN || (dec->header.flags & FLAG_POLICY) > LZ78_ADAPTIVE
+        || (dec->header.flags & FLAG_LZW && dec->header.flags & FLAG_DICT)) {
+        dec->status = LZ78_ERR_FLAGS;
+        return;
+    }
+    dec->policy = dec->header.flags & FLAG_POLICY;
+    dec->lzw = dec->header.flags & FLAG_LZW;
+    dec->entropy = dec->header.flags & FLAG_ENTROPY;
+    dec->max_code = MAX_CODE(bits);
+    dec->head_size = header_size(dec->header.flags);
+}
+
+// set up the word table once the whole header is in
+static void setup_table(LZ78Decoder *dec) {
+    dec->pr.total_bits += dec->head_size * 8;
+    if (dec->header.flags & FLAG_SIZE) {
+        dec->header.length = load_le64(dec->head + dec->head_size - LENGTH_SIZE);
+    }
+    const LZ78Dict *dict = NULL;
+    if (dec->header.flags & FLAG_DICT) {
+        // the stream needs the very dictionary it was compressed with
+        dict = dec->dict;
+        if (!dict || dict->id != load_le32(dec->head + HEADER_SIZE)
+            || !lz78_dict_fits(dict, get_bitlen(dec->max_code))) {
+            dec->status = LZ78_ERR_DICT;
+            return;
+        }
+    }
+    // create a new word table, with max_code spare for words of a frozen dictionary
+    // a table left by an earlier stream is reused if it's big enough
+    if (dec->table_size < dec->max_code + 1) {
+        wt_delete(dec->table);
+        dec->table = wt_create(dec->max_code);
+        dec->table_size = dec->table ? dec->max_code + 1 : 0;
+    }
+    if (!dec->table) {
+        dec->status = LZ78_ERR_MEMORY;
+        return;
+    }
+    // entries of the dictionary are never overwritten, so they outlast resets
+    for (uint32_t i = 0; dict && i < dict->count; i += 1) {
+        wt_add(dec->table, START_CODE + i, dict->prefix[i], dict->sym[i]);
+    }
+    dec->base_code = START_CODE + (dict ? dict->count : 0);
+    // LZW's single symbols are there from the start and outlast resets too
+    for (uint32_t sym = 0; dec->lzw && sym < ALPHABET; sym += 1) {
+        wt_add(dec->table, START_CODE + sym, EMPTY_CODE, sym);
+    }
+    dec->base_code += dec->lzw ? ALPHABET : 0;
+    dec->next_code = dec->base_code;
+    dec->ready = true;
+}
+
+// gather header bytes, setting up the table once they're all in
+static size_t decode_header(LZ78Decoder *dec, const uint8_t *buf, size_t len) {
+    size_t taken = 0;
+    while (taken < len && dec->head_len < dec->head_size && dec->status == LZ78_OK) {
+        size_t take = dec->head_size - dec->head_len;
+        if (take > len - taken) {
+            take = len - taken;
+        }
+        memcpy(dec->head + dec->head_len, buf + taken, take);
+        dec->head_len += take;
+        taken += take;
+        // the flags say how much more header there is
+        if (dec->head_len == HEADER_SIZE && dec->head_size == HEADER_SIZE) {
+            check_header(dec);
+        }
+    }
+    if (dec->status == LZ78_OK && dec->head_len == dec->head_size) {
+        setup_table(dec);
+    }
+    return taken;
+}
+
+// use a dictionary for streams compressed with one
+void lz78_decoder_use_dict(LZ78Decoder *dec, const LZ78Dict *dict) {
+    dec->dict = dict;
+}
+
+// hand words to phrases instead of the sink
+void lz78_decoder_phrases(LZ78Decoder *dec, const LZ78Phrases *phrases) {
+    dec->phrases = phrases;
+}
+
+// write the word at code, or hand it to the phrases
+static inline void emit_word(LZ78Decoder *dec, WordTable *table, uint32_t code) {
+    if (dec->phrases) {
+        dec->phrases->phrase(dec->phrases->ctx, table, code);
+        dec->ww.total_syms += table[code].len;
+    } else {
+        write_word(&dec->ww, table, code);
+    }
+}
+
+// start the dictionary over, past the entries that outlast resets
+static void reset_table(LZ78Decoder *dec) {
+    if (dec->phrases) {
+        dec->phrases->reset(dec->phrases->ctx);
+    }
+    wt_reset(dec->table);
+    dec->next_code = dec->base_code;
+    dec->frozen = false;
+    dec->pending = false;
+    dec->resets += 1;
+}
+
+// the codes stopped, the stream ends or, with FLAG_STORED, block says what follows
+static void end_codes(LZ78Decoder *dec, uint8_t block) {
+    if (!(dec->header.flags & FLAG_STORED) || block == BLOCK_END) {
+        dec->stopped = true;
+    } else if (block == BLOCK_STORED) {
+        // an LZW entry waiting on the next word never gets its symbol, the encoder
+        // skipped its code, so any symbol will do
+        if (dec->pending) {
+            wt_add(dec->table, dec->next_code - 1, dec->prev_code, 0);
+            dec->pending = false;
+        }
+        dec->stage = STAGE_SIZE;
+        dec->size_len = 0;
+    } else {
+        dec->status = LZ78_ERR_CORRUPT;
+    }
+}
+
+// read pairs until the input fed so far runs out or STOP_CODE
+static void decode_pairs(LZ78Decoder *dec) {
+    WordTable *table = dec->table;
+    uint32_t curr_code = 0;
+    uint8_t curr_sym = 0;
+    int bitlen = get_bitlen(dec->next_code);
+    // while there are whole pairs left to read
+    while (!dec->stopped
+           && (dec->entropy ? read_coded(&dec->pr, &dec->coded, &curr_code, &curr_sym, bitlen)
+                            : read_pair(&dec->pr, &curr_code, &curr_sym, bitlen))) {
+        dec->code_widths[bitlen] += 1;
+        // STOP_CODE ends the pairs, its symbol is the block type that follows
+        if (curr_code == STOP_CODE) {
+            end_codes(dec, curr_sym);
+            break;
+        }
+        // a valid stream only refers to codes already in the table
+        if (curr_code >= dec->next_code) {
+            dec->status = LZ78_ERR_CORRUPT;
+            break;
+        }
+        // add word noted by curr code appended with read symbol to table
+        // a frozen table spells it in the spare entry at max_code instead
+        uint32_t code = dec->frozen ? dec->max_code : dec->next_code;
+        wt_add(table, code, curr_code, curr_sym);
+        // write word constructed above to the output
+        emit_word(dec, table, code);
+        uint32_t len = table[code].len;
+        dec->phrase_lens[get_bitlen(len) - 1] += 1;
+        if (dec->frozen) {
+            // the encoder judges the same windows, so resets line up
+            if (dec->policy == LZ78_ADAPTIVE && adapt(&dec->window, bitlen + 8, len)) {
+                reset_table(dec);
+            }
+        } else {
+            // increment next code
+            dec->next_code += 1;
+            // if we've reached max code, reset or freeze the wt
+            if (dec->next_code == dec->max_code) {
+                if (dec->policy == LZ78_RESET) {
+                    reset_table(dec);
+                } else {
+                    dec->frozen = true;
+                    memset(&dec->window, 0, sizeof(Window));
+                }
+            }
+        }
+        bitlen = get_bitlen(dec->next_code);
+    }
+}
+
+// read LZW codes until the input fed so far runs out or STOP_CODE
+// each code finishes the last word's entry with its first symbol, then
+// reserves the next entry for its own word, growing, freezing or resetting
+// the table exactly when the encoder did on the same code
+static void decode_codes(LZ78Decoder *dec) {
+    WordTable *table = dec->table;
+    uint32_t curr_code = 0;
+    int bitlen = get_bitlen(dec->next_code);
+    while (!dec->stopped
+           && (dec->entropy ? read_coded(&dec->pr, &dec->coded, &curr_code, NULL, bitlen)
+                            : read_code(&dec->pr, &curr_code, bitlen))) {
+        dec->code_widths[bitlen] += 1;
+        if (curr_code == STOP_CODE) {
+            if (dec->header.flags & FLAG_STORED) {
+                dec->stage = STAGE_BLOCK;
+            } else {
+                dec->stopped = true;
+            }
+            break;
+        }
+        // a valid stream only refers to words already in the table, or the one being added
+        if (curr_code < START_CODE || curr_code >= dec->next_code) {
+            dec->status = LZ78_ERR_CORRUPT;
+            break;
+        }
+        if (dec->pending) {
+            // a code naming the entry being added starts with the last word's first symbol
+            uint32_t code = dec->next_code - 1;
+            uint8_t first = table[curr_code == code ? dec->prev_code : curr_code].first;
+            wt_add(table, code, dec->prev_code, first);
+            dec->pending = false;
+        }
+        emit_word(dec, table, curr_code);
+        uint32_t len = table[curr_code].len;
+        dec->phrase_lens[get_bitlen(len) - 1] += 1;
+        dec->prev_code = curr_code;
+        if (dec->frozen) {
+            // the encoder judges the same windows, so resets line up
+            if (dec->policy == LZ78_ADAPTIVE && adapt(&dec->window, bitlen, len)) {
+                reset_table(dec);
+            }
+        } else {
+            // the encoder added this word's entry as soon as it saw the next symbol
+            dec->pending = true;
+            dec->next_code += 1;
+            if (dec->next_code == dec->max_code) {
+                if (dec->policy == LZ78_RESET) {
+                    // the entry went with the reset, nothing waits for it
+                    reset_table(dec);
+                } else {
+                    dec->frozen = true;
+                    memset(&dec->window, 0, sizeof(Window));
+                }
+            }
+        }
+        bitlen = get_bitlen(dec->next_code);
+    }
+}
+
+// read whatever the input fed so far holds, codes and the stored blocks between them
+static void decode_blocks(LZ78Decoder *dec) {
+    while (!dec->stopped && dec->status == LZ78_OK) {
+        if (dec->stage == STAGE_CODES) {
+            if (dec->lzw) {
+                decode_codes(dec);
+            } else {
+                decode_pairs(dec);
+            }
+            // a coded block ends with its STOP_CODE
+            bool stopped = dec->stopped || dec->stage != STAGE_CODES;
+            if (dec->coded.corrupt || (stopped && dec->coded.left)) {
+                dec->status = LZ78_ERR_CORRUPT;
+                return;
+            }
+            // still on codes, the input ran out before a STOP_CODE
+            if (dec->stage == STAGE_CODES) {
+                return;
+            }
+        } else if (dec->stage == STAGE_BLOCK) {
+            uint32_t block = 0;
+            if (!read_code(&dec->pr, &block, 8)) {
+                return;
+            }
+            end_codes(dec, block);
+        } else if (dec->stage == STAGE_SIZE) {
+            // the length may come in pieces
+            int want = STORED_SIZE - dec->size_len;
+            dec->size_len += read_tail(&dec->pr, dec->size + dec->size_len, want);
+            if (dec->size_len < STORED_SIZE) {
+                return;
+            }
+            // the encoder never stores more than a block at a time
+            dec->stored_left = load_le32(dec->size);
+            if (dec->stored_left > STORED_BLOCK) {
+                dec->status = LZ78_ERR_CORRUPT;
+                return;
+            }
+            dec->stage = dec->stored_left ? STAGE_STORED : STAGE_CODES;
+        } else {
+            // copied straight from the input to the output where possible
+            const uint8_t *span = NULL;
+            size_t got = read_span(&dec->pr, &span, dec->stored_left);
+            if (got == 0) {
+                return;
+            }
+            if (dec->phrases) {
+                dec->phrases->stored(dec->phrases->ctx, span, got);
+                dec->ww.total_syms += got;
+            } else {
+                write_syms(&dec->ww, span, got);
+            }
+            dec->stored_left -= got;
+            dec->stored_syms += got;
+            if (dec->stored_left == 0) {
+                dec->stage = STAGE_CODES;
+            }
+        }
+    }
+}
+
+// decompress a span of compressed input
+LZ78Status lz78_decoder_update(LZ78Decoder *dec, const uint8_t *buf, size_t len) {
+    if (dec->finished) {
+        return LZ78_ERR_STATE;
+    }
+    if (dec->status != LZ78_OK || dec->done) {
+        return dec->status;
+    }
+    if (!dec->ready) {
+        size_t taken = decode_header(dec, buf, len);
+        buf += taken;
+        len -= taken;
+        if (dec->status != LZ78_OK || !dec->ready) {
+            return dec->status;
+        }
+    }
+
+    pr_feed(&dec->pr, buf, len);
+    // a decoder that seeked starts partway into the first byte
+    if (dec->skip) {
+        uint32_t bits = 0;
+        if (!read_code(&dec->pr, &bits, dec->skip)) {
+            return dec->status;
+        }
+        dec->skip = 0;
+    }
+    decode_blocks(dec);
+    // output past the recorded length can't be right, stop before writing more
+    if (dec->status == LZ78_OK && dec->header.flags & FLAG_SIZE
+        && dec->ww.total_syms > dec->header.length) {
+        dec->status = LZ78_ERR_LENGTH;
+    }
+    // the checksum trailer may come in pieces too
+    if (dec->stopped && dec->status == LZ78_OK) {
+        if (dec->header.flags & FLAG_CRC) {
+            int want = CRC_SIZE - dec->tail_len;
+            dec->tail_len += read_tail(&dec->pr, dec->tail + dec->tail_len, want);
+        }
+        dec->done = !(dec->header.flags & FLAG_CRC) || dec->tail_len == CRC_SIZE;
+    }
+    if (dec->status == LZ78_OK && dec->ww.error) {
+        dec->status = LZ78_ERR_SINK;
+    }
+    return dec->status;
+}
+
+// end the stream
+LZ78Status lz78_decoder_finish(LZ78Decoder *dec) {
+    if (dec->finished) {
+        return LZ78_ERR_STATE;
+    }
+    dec->finished = true;
+    // flush buffered words
+    flush_words(&dec->ww);
+    if (dec->status == LZ78_OK && dec->ww.error) {
+        dec->status = LZ78_ERR_SINK;
+    }
+    // a segment between resets is whole once it comes to the output it should
+    if (dec->seeked) {
+        if (dec->status == LZ78_OK && dec->seek_syms == LZ78_UNKNOWN_LENGTH && !dec->done) {
+            dec->status = LZ78_ERR_TRUNCATED;
+        } else if (dec->status == LZ78_OK && dec->seek_syms != LZ78_UNKNOWN_LENGTH
+                   && dec->ww.total_syms != dec->seek_syms) {
+            dec->status = dec->ww.total_syms < dec->seek_syms ? LZ78_ERR_TRUNCATED : LZ78_ERR_INDEX;
+        }
+        return dec->status;
+    }
+    if (dec->status == LZ78_OK && !dec->done) {
+        dec->status = LZ78_ERR_TRUNCATED;
+    }
+    if (dec->status == LZ78_OK && dec->header.flags & FLAG_SIZE
+        && dec->ww.total_syms != dec->header.length) {
+        dec->status = LZ78_ERR_LENGTH;
+    }
+    // every word has gone through crc_sink now, unless they went to the phrases
+    if (dec->status == LZ78_OK && dec->header.flags & FLAG_CRC && !dec->phrases
+        && dec->crc != load_le32(dec->tail)) {
+        dec->status = LZ78_ERR_CHECKSUM;
+    }
+    return dec->status;
+}
+
+// start a decoder at a reset noted in a stream's seek index
+LZ78Status lz78_decoder_seek(
+    LZ78Decoder *dec, const uint8_t *head, size_t head_len, uint64_t bit, uint64_t syms) {
+    if (dec->finished || dec->head_len > 0) {
+        return LZ78_ERR_STATE;
+    }
+    size_t taken = decode_header(dec, head, head_len);
+    if (dec->status == LZ78_OK && (!dec->ready || taken != head_len)) {
+        dec->status = LZ78_ERR_TRUNCATED;
+    }
+    // every reset comes after the header
+    if (dec->status == LZ78_OK && bit < (uint64_t) dec->head_size * 8) {
+        dec->status = LZ78_ERR_INDEX;
+    }
+    if (dec->status != LZ78_OK) {
+        return dec->status;
+    }
+    // the table is as it was after the header, it's where the input starts that moves
+    dec->seeked = true;
+    dec->seek_syms = syms;
+    dec->skip = bit % 8;
+    dec->pr.total_bits = bit - dec->skip;
+    return LZ78_OK;
+}
+
+// header of the stream once it's been read
+const FileHeader *lz78_decoder_header(LZ78Decoder *dec) {
+    if (dec->head_len < dec->head_size) {
+        return NULL;
+    }
+    return &dec->header;
+}
+
+// the most output len bytes of a stream with header can decompress to
+uint64_t lz78_max_length(const FileHeader *header, uint64_t len) {
+    int bits = header->bits ? header->bits : DEFAULT_BITS;
+    bits = bits > MAX_BITS ? MAX_BITS : bits;
+    // every code takes at least a bit and spells at most a word per dictionary entry
+    uint64_t per_bit = (uint64_t) MAX_CODE(bits) + 1;
+    return len > UINT64_MAX / 8 / per_bit ? UINT64_MAX : len * 8 * per_bit;
+}
+
+// report decoder stats
+void lz78_decoder_stats(LZ78Decoder *dec, LZ78Stats *stats) {
+    memset(stats, 0, sizeof(LZ78Stats));
+    stats->syms = dec->ww.total_syms;
+    stats->bits = dec->pr.total_bits;
+    stats->dict_bytes = dec->table_size * sizeof(WordEntry);
+    if (dec->table) {
+        stats->entries = (dec->resets || dec->frozen ? dec->max_code : dec->next_code) - EMPTY_CODE;
+    }
+    stats->resets = dec->resets;
+    stats->stored = dec->stored_syms;
+    memcpy(stats->phrase_lens, dec->phrase_lens, sizeof(stats->phrase_lens));
+    memcpy(stats->code_widths, dec->code_widths, sizeof(stats->code_widths));
+}
+
+// add up stats of separate streams
+void lz78_stats_merge(LZ78Stats *total, const LZ78Stats *stats) {
+    total->syms += stats->syms;
+    total->bits += stats->bits;
+    if (stats->dict_bytes > total->dict_bytes) {
+        total->dict_bytes = stats->dict_bytes;
+    }
+    if (stats->entries > total->entries) {
+        total->entries = stats->entries;
+    }
+    total->resets += stats->resets;
+    total->stored += stats->stored;
+    for (int i = 0; i < PHRASE_BUCKETS; i += 1) {
+        total->phrase_lens[i] += stats->phrase_lens[i];
+    }
+    for (int i = 0; i <= MAX_BITS; i += 1) {
+        total->code_widths[i] += stats->code_widths[i];
+    }
+    total->read_ns += stats->read_ns;
+    total->codec_ns += stats->codec_ns;
+    total->write_ns += stats->write_ns;
+}
+
+// destructor for a decoder
+void lz78_decoder_delete(LZ78Decoder *dec) {
+    if (dec) {
+        wt_delete(dec->table);
+        ww_free(&dec->ww);
+        free(dec);
+    }
+}
+
+// compress a whole buffer
+LZ78Status lz78_compress(
+    const uint8_t *src, size_t len, uint8_t **dst, size_t *dst_len, const LZ78Options *opts) {
+    Buffer out = { 0 };
+    LZ78Encoder *enc = lz78_encoder_create(opts, buffer_sink, &out);
+    if (!enc) {
+        return LZ78_ERR_MEMORY;
+    }
+    LZ78Status status = lz78_encoder_update(enc, src, len);
+    if (status == LZ78_OK) {
+        status = lz78_encoder_finish(enc);
+    }
+    lz78_encoder_delete(enc);
+    if (status != LZ78_OK) {
+        free(out.data);
+        return status;
+    }
+    *dst = out.data;
+    *dst_len = out.len;
+    return LZ78_OK;
+}
+
+// decompress a whole buffer
+LZ78Status lz78_decompress(const uint8_t *src, size_t len, uint8_t **dst, size_t *dst_len) {
+    Buffer out = { 0 };
+    LZ78Decoder *dec = lz78_decoder_create(buffer_sink, &out);
+    if (!dec) {
+        return LZ78_ERR_MEMORY;
+    }
+    // read the header on its own, a recorded length sizes the output in one go
+    size_t head_len = len < HEADER_SIZE ? len : HEADER_SIZE;
+    if (head_len == HEADER_SIZE) {
+        FileHeader header;
+        read_header(src, &header);
+        size_t size = header_size(header.flags);
+        head_len = len < size ? len : size;
+    }
+    LZ78Status status = lz78_decoder_update(dec, src, head_len);
+    const FileHeader *header = lz78_decoder_header(dec);
+    if (status == LZ78_OK && header && header->flags & FLAG_SIZE) {
+        // no more than the input can come to, a forged length can't reserve more
+        // too big to get at once, it can still grow as it goes
+        uint64_t bound = lz78_max_length(header, len);
+        uint64_t size = header->length < bound ? header->length : bound;
+        if (size <= SIZE_MAX) {
+            buffer_reserve(&out, size);
+        }
+    }
+    if (status == LZ78_OK) {
+        status = lz78_decoder_update(dec, src + head_len, len - head_len);
+    }
+    if (status == LZ78_OK) {
+        status = lz78_decoder_finish(dec);
+    }
+    lz78_decoder_delete(dec);
+    if (status != LZ78_OK) {
+        free(out.data);
+        return status;
+    }
+    *dst = out.data;
+    *dst_len = out.len;
+    return LZ78_OK;
+}
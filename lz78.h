@@ -0,0 +1,397 @@
+#ifndef __LZ78_H__
+#define __LZ78_H__
+
+#include "code.h"
+#include "io.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * liblz78: LZ78 compression without file descriptors or global state
+ * Every stream has its own encoder or decoder context, so any number of
+ * them can run side by side in one process
+ * Output is handed to a Sink a block at a time
+ */
+
+typedef enum LZ78Status {
+    LZ78_OK = 0,
+    LZ78_ERR_MEMORY, // Out of memory.
+    LZ78_ERR_SINK, // The sink refused output.
+    LZ78_ERR_MAGIC, // Input isn't an LZ78 stream.
+    LZ78_ERR_BITS, // Unsupported dictionary code width.
+    LZ78_ERR_CORRUPT, // Stream refers to codes that don't exist.
+    LZ78_ERR_TRUNCATED, // Stream ends before its STOP_CODE or checksum.
+    LZ78_ERR_STATE, // Call made after the stream was finished.
+    LZ78_ERR_FLAGS, // Stream uses features this version doesn't know.
+    LZ78_ERR_DICT, // Dictionary is missing, doesn't match or doesn't fit.
+    LZ78_ERR_CHECKSUM, // Decompressed data doesn't match the stream's CRC32C.
+    LZ78_ERR_INPUT, // Input couldn't be opened or read.
+    LZ78_ERR_LENGTH, // Uncompressed length doesn't match the one in the header.
+    LZ78_ERR_INDEX, // Seek index is missing or doesn't match the stream.
+} LZ78Status;
+
+/*
+ * What happens once every code of the dictionary is in use
+ * The policy is recorded in the header and the decoder follows along, the
+ * adaptive reset is decided from pair sizes both sides see, so the stream
+ * needs no extra codes for it
+ */
+typedef enum LZ78Policy {
+    LZ78_RESET = 0, // Start over with an empty dictionary.
+    LZ78_FREEZE, // Stop adding phrases, keep matching against the full dictionary.
+    LZ78_ADAPTIVE, // Freeze, then start over once the ratio degrades, see ADAPT_SLACK.
+} LZ78Policy;
+
+/*
+ * How the encoder finds the phrase extending the current one by a symbol
+ * Engines only change speed and memory, the stream is the same either way
+ */
+typedef enum LZ78Engine {
+    LZ78_TRIE = 0, // Tree of nodes, a pointer chased per symbol, see trie.h.
+    LZ78_HASH, // Flat open-addressing table keyed by (code, symbol), see hash.h.
+} LZ78Engine;
+
+/*
+ * What a stream sends for each phrase
+ * LZW dictionaries start out holding every single symbol, at START_CODE +
+ * symbol, so a phrase is just the code of its longest match and the symbol
+ * that ends it starts the next phrase instead
+ * The decoder adds each phrase once the next code tells it that symbol, so
+ * a code can name the very phrase that's being added
+ */
+typedef enum LZ78Format {
+    LZ78_PAIRS = 0, // A code and a symbol per phrase.
+    LZ78_LZW, // Codes only, recorded in the header as FLAG_LZW.
+} LZ78Format;
+
+#ifndef LZ78_DEFAULT_ENGINE
+#define LZ78_DEFAULT_ENGINE LZ78_TRIE // Engine used unless chosen, build with -D to change it.
+#endif
+
+#define LZ78_MIN_LEVEL 1 // Greedy parsing, the longest phrase every time.
+#define LZ78_MAX_LEVEL 4
+#define LZ78_DEFAULT_LEVEL LZ78_MIN_LEVEL
+
+/*
+ * Levels above LZ78_MIN_LEVEL parse flexibly: once the dictionary is frozen,
+ * before each pair the encoder also tries cutting the phrase up to
+ * LEVEL_CUTS(level) symbols short, and keeps the cut whose next phrase
+ * reaches furthest
+ * A shorter phrase is still a code and a symbol, so decoders can't tell the
+ * difference, but it's already in the dictionary, so while the dictionary
+ * grows the parse stays greedy to add a new phrase with every code
+ */
+#define LEVEL_CUTS(level) ((level) <= LZ78_MIN_LEVEL ? 0 : 1u << (2 * ((level) - 2)))
+#define LOOK_MATCH (1 << 13) // Longest phrase flexible parsing matches, longer ones are cut.
+#define LOOK_WINDOW (2 * LOOK_MATCH + 1) // Input a flexible parse needs ahead of a phrase.
+#define PAIR_BATCH 64 // Pairs a greedy parse gathers before handing them to the pair writer.
+
+#define LZ78_UNKNOWN_LENGTH UINT64_MAX // Input length that isn't recorded in the header.
+
+#define ADAPT_WINDOW (1 << 16) // Uncompressed bytes per window judged by LZ78_ADAPTIVE.
+#define ADAPT_SLACK 10 // Percent a window may compress worse than the best before a reset.
+
+/*
+ * Input is judged a block of STORED_BLOCK bytes at a time, from the start of
+ * the stream. A block whose bytes carry STORED_ENTROPY bits or more each,
+ * going by how often each byte value turns up, is coded on its own from a
+ * fresh dictionary as a trial. If the codes come out no smaller than the
+ * block, it's stored as it is in a BLOCK_STORED block instead and the
+ * dictionary doesn't see it. Blocks of fewer bits per byte are always coded.
+ */
+#define STORED_BLOCK (1 << 16)
+#define STORED_ENTROPY 7 // Bits per byte, LZ78 expands uniform data from about 6.6.
+
+/*
+ * Seek index, written after the end of the stream with LZ78Options.index,
+ * all fields little endian:
+ *
+ *   count           4 bytes number of dictionary resets
+ *   length          8 bytes uncompressed length of the stream
+ *   entries         for each reset: 8 bytes bit offset of the first code
+ *                   after it from the start of the stream, 8 bytes offset
+ *                   of the output that code starts
+ *   footer          8 bytes offset of the index from the start of the
+ *                   stream, 4 bytes MAGIC_INDEX
+ *
+ * After a reset the decoder has only what it had after the header, so the
+ * codes from one reset up to the next decode on their own, see
+ * lz78_decoder_seek(). Decoders that don't look for the index stop at the
+ * end of the stream and never see it.
+ */
+#define MAGIC_INDEX 0xBAAD5EEC // Magic number ending a seek index.
+#define INDEX_HEAD_SIZE 12 // Bytes ahead of the entries.
+#define INDEX_ENTRY_SIZE 16 // Bytes per reset.
+#define INDEX_FOOTER_SIZE 12 // Bytes of the footer.
+
+/*
+ * Dictionary file, all fields little endian:
+ *
+ *   magic           4 bytes DICT_MAGIC
+ *   ID              4 bytes, FNV-1a of the entries, recorded in every stream
+ *                   compressed with the dictionary
+ *   count           4 bytes number of entries
+ *   entries         for each: 4 bytes prefix code, 1 byte symbol
+ *
+ * Entry i gets code START_CODE + i and extends the entry at its prefix code,
+ * EMPTY_CODE for single symbols, so prefixes always come first.
+ */
+#define DICT_MAGIC 0xBAADD1C7 // Magic number of dictionary files.
+#define DICT_HEAD_SIZE 12 // Bytes ahead of the entries.
+#define DICT_ENTRY_SIZE 5 // Bytes per entry.
+#define DICT_ENTRIES 4096 // Entries trained by default.
+
+typedef struct LZ78Dict LZ78Dict;
+
+typedef struct LZ78Options {
+    int bits; // Dictionary code width, MIN_BITS to MAX_BITS.
+    uint16_t protection; // Recorded in the header for the decoder.
+    LZ78Policy policy; // What to do when the dictionary fills up.
+    const LZ78Dict *dict; // Pretrained dictionary to start from, NULL for none.
+    LZ78Engine engine; // Dictionary engine of the encoder, decoders don't use one.
+    bool checksum; // End the stream with a CRC32C of the input, on by default.
+    uint64_t length; // Input length to record in the header, LZ78_UNKNOWN_LENGTH by default.
+    int level; // Parsing effort, LZ78_MIN_LEVEL to LZ78_MAX_LEVEL, pairs only.
+    LZ78Format format; // LZ78_LZW can't start from a pretrained dictionary.
+    bool stored; // Store blocks that don't compress as they are, on by default.
+    bool index; // End the stream with a seek index of its resets, off by default.
+    bool entropy; // Huffman code the pairs a block at a time, see PairCoder, off by default.
+} LZ78Options;
+
+#define PHRASE_BUCKETS 32 // Phrase length histogram buckets, see LZ78Stats.
+
+/*
+ * Bucket i of phrase_lens counts phrases of 2^i to 2^(i+1) - 1 symbols
+ * code_widths counts pairs by the bit width of their code, STOP_CODE included
+ * The codec leaves the *_ns timings at 0, they're filled by whoever does the
+ * reading and writing (chunked_encode(), chunked_decode(), encode, decode)
+ */
+typedef struct LZ78Stats {
+    uint64_t syms; // Uncompressed bytes.
+    uint64_t bits; // Compressed bits, header included.
+    uint64_t dict_bytes; // Peak memory held by the dictionary.
+    uint64_t entries; // Peak dictionary entries in use, root included.
+    uint64_t resets; // Times the dictionary started over.
+    uint64_t stored; // Uncompressed bytes in stored blocks.
+    uint64_t phrase_lens[PHRASE_BUCKETS];
+    uint64_t code_widths[MAX_BITS + 1];
+    uint64_t read_ns; // Waiting on input.
+    uint64_t codec_ns; // Compressing or decompressing.
+    uint64_t write_ns; // Handing over output.
+} LZ78Stats;
+
+typedef struct LZ78Encoder LZ78Encoder;
+
+typedef struct LZ78Decoder LZ78Decoder;
+
+/*
+ * Where a decoder hands its words instead of writing them out, see
+ * lz78_decoder_phrases(), ctx is passed back untouched
+ * phrase: the next word of the output is the one at code, spelled by
+ *     following prefix codes back to EMPTY_CODE (see wt_spell()), the entry
+ *     at max_code is reused for every word of a frozen pairs dictionary
+ * stored: the next len bytes of the output, from a stored block
+ * reset: the dictionary is starting over, the entries of earlier codes stay
+ *     in the table until it returns
+ */
+typedef struct LZ78Phrases {
+    void (*phrase)(void *ctx, const WordTable *table, uint32_t code);
+    void (*stored)(void *ctx, const uint8_t *buf, size_t len);
+    void (*reset)(void *ctx);
+    void *ctx;
+} LZ78Phrases;
+
+/*
+ * Returns the options used when none are given
+ */
+LZ78Options lz78_default_options(void);
+
+/*
+ * Returns a description of status
+ */
+const char *lz78_strerror(LZ78Status status);
+
+/*
+ * Constructor: Loads a dictionary from the dictionary file contents at buf
+ * Returns NULL if out of memory or buf isn't a valid dictionary file
+ */
+LZ78Dict *lz78_dict_load(const uint8_t *buf, size_t len);
+
+/*
+ * Constructor: Loads a dictionary from the whole of dictionary file infile
+ * Returns NULL if out of memory or infile isn't a valid dictionary file
+ */
+LZ78Dict *lz78_dict_read(int infile);
+
+uint32_t lz78_dict_id(const LZ78Dict *dict);
+
+uint32_t lz78_dict_entries(const LZ78Dict *dict);
+
+/*
+ * Returns true if dict leaves room to grow in a dictionary of bits wide codes
+ */
+bool lz78_dict_fits(const LZ78Dict *dict, int bits);
+
+/*
+ * Destructor: Frees a dictionary, after every stream using it is done
+ */
+void lz78_dict_delete(LZ78Dict *dict);
+
+/*
+ * Trains a dictionary of up to entries entries on n samples, samples[i]
+ * being lens[i] bytes, and writes it as a dictionary file into a newly
+ * allocated buffer at *dst of *dst_len bytes
+ * Each sample is parsed from an empty dictionary, the phrases matched most
+ * often are kept
+ * The caller frees *dst
+ */
+LZ78Status lz78_dict_train(const uint8_t *const *samples, const size_t *lens, size_t n,
+    uint32_t entries, uint8_t **dst, size_t *dst_len);
+
+/*
+ * Constructor: Creates an encoder that hands compressed blocks to sink
+ * opts may be NULL for the defaults
+ * opts->dict must outlive the encoder
+ * Returns NULL if out of memory or opts are invalid
+ */
+LZ78Encoder *lz78_encoder_create(const LZ78Options *opts, Sink sink, void *ctx);
+
+/*
+ * Starts a new stream on enc once the last one is finished, with the same
+ * options but protection and length, writing to sink
+ * The dictionary starts over but its memory is kept, so encoding many small
+ * inputs doesn't allocate a dictionary for each
+ * Returns LZ78_ERR_MEMORY if a pretrained dictionary couldn't be loaded again
+ */
+LZ78Status lz78_encoder_restart(
+    LZ78Encoder *enc, uint16_t protection, uint64_t length, Sink sink, void *ctx);
+
+/*
+ * Compresses the next len bytes of input at buf
+ * Matches carry over from one call to the next
+ */
+LZ78Status lz78_encoder_update(LZ78Encoder *enc, const uint8_t *buf, size_t len);
+
+/*
+ * Ends the stream: writes out the last pair and STOP_CODE and flushes
+ * Returns LZ78_ERR_LENGTH if the input wasn't the length given in the options
+ */
+LZ78Status lz78_encoder_finish(LZ78Encoder *enc);
+
+/*
+ * Fills stats for the stream so far, timings are left at 0
+ */
+void lz78_encoder_stats(LZ78Encoder *enc, LZ78Stats *stats);
+
+/*
+ * Destructor: Frees the encoder and its dictionary
+ */
+void lz78_encoder_delete(LZ78Encoder *enc);
+
+/*
+ * Constructor: Creates a decoder that hands decompressed blocks to sink
+ * Returns NULL if out of memory
+ */
+LZ78Decoder *lz78_decoder_create(Sink sink, void *ctx);
+
+/*
+ * Starts a new stream on dec, writing to sink
+ * The word table is kept for the next stream if it's big enough for it, and
+ * so are the dictionary given with lz78_decoder_use_dict() and the phrases
+ * given with lz78_decoder_phrases()
+ */
+void lz78_decoder_restart(LZ78Decoder *dec, Sink sink, void *ctx);
+
+/*
+ * Gives the decoder the dictionary streams compressed with one start from
+ * Must be called before the header is fed, dict must outlive the decoder
+ * Streams that don't use a dictionary ignore it
+ */
+void lz78_decoder_use_dict(LZ78Decoder *dec, const LZ78Dict *dict);
+
+/*
+ * Hands the decoder's words to phrases instead of writing them to its sink,
+ * for working on a stream's phrases without spelling each of them out
+ * Lengths are checked as usual, the checksum isn't, there's no output for it
+ * Must be called before anything is fed, phrases must outlive the decoder
+ */
+void lz78_decoder_phrases(LZ78Decoder *dec, const LZ78Phrases *phrases);
+
+/*
+ * Decompresses the next len bytes of compressed input at buf
+ * Input may be split anywhere, even in the middle of the header or a pair
+ * Input past the STOP_CODE, or the checksum after it, is ignored
+ */
+LZ78Status lz78_decoder_update(LZ78Decoder *dec, const uint8_t *buf, size_t len);
+
+/*
+ * Ends the stream: flushes output and checks the STOP_CODE was seen and the
+ * output matches the checksum and length, if the stream has them
+ */
+LZ78Status lz78_decoder_finish(LZ78Decoder *dec);
+
+/*
+ * Starts dec partway into a stream, at a dictionary reset recorded in its
+ * seek index, instead of at its start
+ * head[0..head_len) is the whole header of the stream, the input fed after
+ * is the stream from byte bit / 8 on, bit being the reset's bit offset
+ * syms is the output from the reset up to the next one, or
+ * LZ78_UNKNOWN_LENGTH for the last reset, whose output runs up to STOP_CODE
+ * Input up to the byte the next reset starts in is enough, the rest of
+ * that byte is too short for a code, so none past the reset are decoded
+ * lz78_decoder_finish() checks the output comes to syms, or that the
+ * STOP_CODE was seen, the checksum and length cover the whole stream so
+ * they're left to the caller
+ * Must be called on a new or restarted decoder, after any dictionary
+ */
+LZ78Status lz78_decoder_seek(
+    LZ78Decoder *dec, const uint8_t *head, size_t head_len, uint64_t bit, uint64_t syms);
+
+/*
+ * Returns the header of the stream, NULL until all of it has been fed
+ * With FLAG_SIZE its length is the output to expect, for sizing buffers
+ * or files ahead of decompressing
+ */
+const FileHeader *lz78_decoder_header(LZ78Decoder *dec);
+
+/*
+ * Returns the most output len bytes of a stream with header can decompress
+ * to, however they're coded: every code takes at least a bit and spells at
+ * most a word per dictionary entry
+ * A header's length isn't checked until the end, this bounds what it may
+ * reserve ahead of decompressing
+ */
+uint64_t lz78_max_length(const FileHeader *header, uint64_t len);
+
+/*
+ * Fills stats for the stream so far, timings are left at 0
+ */
+void lz78_decoder_stats(LZ78Decoder *dec, LZ78Stats *stats);
+
+/*
+ * Adds the counts of stats to total, keeping the larger of the peaks
+ */
+void lz78_stats_merge(LZ78Stats *total, const LZ78Stats *stats);
+
+/*
+ * Destructor: Frees the decoder and its dictionary
+ */
+void lz78_decoder_delete(LZ78Decoder *dec);
+
+/*
+ * Compresses src[0..len) into a newly allocated buffer at *dst of *dst_len bytes
+ * opts may be NULL for the defaults
+ * The caller frees *dst
+ */
+LZ78Status lz78_compress(
+    const uint8_t *src, size_t len, uint8_t **dst, size_t *dst_len, const LZ78Options *opts);
+
+/*
+ * Decompresses src[0..len) into a newly allocated buffer at *dst of *dst_len bytes
+ * Streams that record their length get a buffer of that size up front
+ * The caller frees *dst
+ */
+LZ78Status lz78_decompress(const uint8_t *src, size_t len, uint8_t **dst, size_t *dst_len);
+
+#endif
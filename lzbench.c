@@ -0,0 +1,618 @@
+#include "code.h"
+#include "endian.h"
+#include "hash.h"
+#include "io.h"
+#include "trie.h"
+#include "word.h"
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLES 1
+#define CYCLES() __rdtsc()
+#else
+#define HAVE_CYCLES 0
+#define CYCLES() UINT64_C(0)
+#endif
+
+#define OPTIONS "hs:n:d:"
+#define SEED UINT64_C(0x9E3779B97F4A7C15) // Fixed so every run sees the same corpus.
+
+typedef void (*Generator)(uint64_t *state, uint8_t *buf, size_t len);
+
+typedef struct Corpus {
+    const char *name;
+    Generator gen;
+} Corpus;
+
+// one timed run: wall time, cycles and peak RSS
+typedef struct Sample {
+    uint64_t ns;
+    uint64_t cycles;
+    long rss_kb;
+} Sample;
+
+// xorshift64*, deterministic across platforms
+static inline uint64_t next_rand(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * UINT64_C(0x2545F4914F6CDD1D);
+}
+
+// skewed pick in [0, n), small values far more likely
+static inline uint32_t skewed(uint64_t *state, uint32_t n) {
+    uint64_t r = next_rand(state);
+    uint32_t a = r % n;
+    uint32_t b = (r >> 32) % n;
+    return a < b ? a : b;
+}
+
+static const char *words[] = { "the", "of", "and", "to", "in", "a", "is", "that", "for", "it",
+    "as", "was", "with", "be", "by", "on", "not", "he", "this", "are", "or", "his", "from", "at",
+    "which", "but", "have", "an", "had", "they", "you", "were", "their", "one", "all", "we",
+    "can", "her", "has", "there", "been", "if", "more", "when", "will", "would", "who", "so",
+    "dictionary", "compression", "symbol", "prefix", "stream", "encoder", "decoder", "block",
+    "pair", "code", "buffer", "output", "input", "memory", "thread", "window", "entropy" };
+
+// copy a string into buf, clipped at the end
+static size_t put_str(uint8_t *buf, size_t at, size_t len, const char *s) {
+    while (*s && at < len) {
+        buf[at] = *s;
+        at += 1;
+        s += 1;
+    }
+    return at;
+}
+
+// english-like prose drawn from a skewed vocabulary
+static void gen_text(uint64_t *state, uint8_t *buf, size_t len) {
+    size_t nwords = sizeof(words) / sizeof(words[0]);
+    size_t at = 0;
+    uint32_t in_line = 0;
+    while (at < len) {
+        at = put_str(buf, at, len, words[skewed(state, nwords)]);
+        in_line += 1;
+        uint32_t r = next_rand(state) % 16;
+        if (r == 0) {
+            at = put_str(buf, at, len, ".");
+        } else if (r == 1) {
+            at = put_str(buf, at, len, ",");
+        }
+        at = put_str(buf, at, len, in_line > 10 && r < 4 ? "\n" : " ");
+        in_line = in_line > 10 && r < 4 ? 0 : in_line;
+    }
+}
+
+// timestamped service log lines with repeating fields
+static void gen_logs(uint64_t *state, uint8_t *buf, size_t len) {
+    static const char *levels[] = { "INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR" };
+    static const char *paths[] = { "users", "orders", "items", "health", "search", "login" };
+    static const int statuses[] = { 200, 200, 200, 201, 204, 304, 404, 500 };
+    char line[160];
+    size_t at = 0;
+    uint64_t ms = 0;
+    while (at < len) {
+        ms += next_rand(state) % 50;
+        uint64_t r = next_rand(state);
+        snprintf(line, sizeof(line),
+            "2024-01-01T%02u:%02u:%02u.%03uZ %s [worker-%u] request id=%08x path=/api/v1/%s "
+            "status=%d latency=%ums\n",
+            (unsigned) (ms / 3600000 % 24), (unsigned) (ms / 60000 % 60),
+            (unsigned) (ms / 1000 % 60), (unsigned) (ms % 1000), levels[r % 6],
+            (unsigned) ((r >> 8) % 8), (unsigned) (r >> 32), paths[(r >> 16) % 6],
+            statuses[(r >> 24) % 8], (unsigned) skewed(state, 2000));
+        at = put_str(buf, at, len, line);
+    }
+}
+
+// uniformly random bytes, incompressible
+static void gen_random(uint64_t *state, uint8_t *buf, size_t len) {
+    for (size_t i = 0; i < len; i += 1) {
+        buf[i] = next_rand(state) & 0xFF;
+    }
+}
+
+// a single run of zeros
+static void gen_zeros(uint64_t *state, uint8_t *buf, size_t len) {
+    (void) state;
+    memset(buf, 0, len);
+}
+
+// object-file-like records: small counters, nearby pointers, padding and names
+static void gen_binary(uint64_t *state, uint8_t *buf, size_t len) {
+    size_t nwords = sizeof(words) / sizeof(words[0]);
+    uint64_t base = UINT64_C(0x00007F3A12340000);
+    size_t at = 0;
+    uint32_t id = 0;
+    while (at + 32 <= len) {
+        uint64_t r = next_rand(state);
+        uint32_t small = skewed(state, 256);
+        uint64_t ptr = base + (skewed(state, 1 << 16) << 3);
+        store_le32(buf + at, id);
+        store_le32(buf + at + 4, small);
+        store_le64(buf + at + 8, ptr);
+        store_le64(buf + at + 16, r % 4 == 0 ? r : 0);
+        store_le64(buf + at + 24, 0);
+        at += 32;
+        id += 1;
+        // now and then a string table entry
+        if (r % 8 == 0) {
+            at = put_str(buf, at, len, words[skewed(state, nwords)]);
+            at = put_str(buf, at, len, "_");
+            at = put_str(buf, at, len, words[skewed(state, nwords)]);
+            if (at < len) {
+                buf[at] = 0;
+                at += 1;
+            }
+        }
+    }
+    memset(buf + at, 0, len - at);
+}
+
+static const Corpus corpora[] = {
+    { "text", gen_text },
+    { "logs", gen_logs },
+    { "random", gen_random },
+    { "zeros", gen_zeros },
+    { "binary", gen_binary },
+};
+
+// encode settings each corpus is run through: every engine, then every level
+// levels only change the parse of a frozen dictionary, so they run adaptive
+typedef struct Setting {
+    const char *engine;
+    const char *policy;
+    const char *level;
+    const char *format; // pairs, lzw for encode -w or huffman for encode -z
+} Setting;
+
+static const Setting settings[] = {
+    { "trie", "reset", "1", "pairs" },
+    { "hash", "reset", "1", "pairs" },
+    { "trie", "adaptive", "1", "pairs" },
+    { "trie", "adaptive", "2", "pairs" },
+    { "trie", "adaptive", "3", "pairs" },
+    { "trie", "adaptive", "4", "pairs" },
+    { "trie", "reset", "1", "lzw" },
+    { "trie", "adaptive", "1", "lzw" },
+    { "trie", "reset", "1", "huffman" },
+    { "trie", "adaptive", "1", "huffman" },
+};
+
+// monotonic wall clock in nanoseconds
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// generate a corpus into a new buffer
+static uint8_t *make_corpus(const Corpus *c, size_t len) {
+    uint8_t *buf = malloc(len);
+    if (buf) {
+        uint64_t state = SEED;
+        c->gen(&state, buf, len);
+    }
+    return buf;
+}
+
+// write buf to path, false on failure
+static bool save(const char *path, const uint8_t *buf, size_t len) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        return false;
+    }
+    bool ok = write_bytes(fd, (uint8_t *) buf, len) == (int) len;
+    close(fd);
+    return ok;
+}
+
+// size of the file at path, 0 if it doesn't exist
+static uint64_t file_size(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (uint64_t) st.st_size : 0;
+}
+
+// check the file at path holds exactly buf[0..len)
+static bool same(const char *path, const uint8_t *buf, size_t len) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+    Mapping map;
+    bool ok = false;
+    if (map_file(fd, &map)) {
+        ok = map.len == len && memcmp(map.data, buf, len) == 0;
+        unmap_file(&map);
+    }
+    close(fd);
+    return ok;
+}
+
+// run prog -i in -o out [flags...] in a child, timing it and taking its peak RSS
+// flags is NULL or a NULL terminated list of up to 8 arguments
+static bool run(
+    const char *prog, const char *const *flags, const char *in, const char *out, Sample *s) {
+    const char *argv[14] = { prog, "-i", in, "-o", out };
+    for (int i = 0; flags && flags[i] && i < 8; i += 1) {
+        argv[5 + i] = flags[i];
+    }
+    uint64_t start = now_ns();
+    pid_t pid = fork();
+    if (pid == -1) {
+        return false;
+    }
+    if (pid == 0) {
+        execv(prog, (char *const *) argv);
+        _exit(127);
+    }
+    int wstatus = 0;
+    struct rusage ru;
+    if (wait4(pid, &wstatus, 0, &ru) == -1) {
+        return false;
+    }
+    s->ns = now_ns() - start;
+    s->cycles = 0;
+    s->rss_kb = ru.ru_maxrss;
+    return WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0;
+}
+
+// keep the fastest of reps runs
+static bool best_run(const char *prog, const char *const *flags, const char *in, const char *out,
+    int reps, Sample *best) {
+    for (int i = 0; i < reps; i += 1) {
+        Sample s;
+        if (!run(prog, flags, in, out, &s)) {
+            return false;
+        }
+        if (i == 0 || s.ns < best->ns) {
+            best->ns = s.ns;
+        }
+        if (i == 0 || s.rss_kb > best->rss_kb) {
+            best->rss_kb = s.rss_kb;
+        }
+    }
+    return true;
+}
+
+// MB/s for len bytes in ns
+static double mbps(uint64_t len, uint64_t ns) {
+    return ns ? (double) len / (1 << 20) / ((double) ns / 1e9) : 0.0;
+}
+
+// report a microbenchmark as a line of JSON
+static void report(const char *kernel, const char *unit, uint64_t n, const Sample *s) {
+    printf("{\"bench\": \"%s\", \"corpus\": \"text\", \"n\": %" PRIu64 ", \"unit\": \"%s\", "
+           "\"ns_per_unit\": %.3f, ",
+        kernel, n, unit, (double) s->ns / n);
+    if (HAVE_CYCLES) {
+        printf("\"cycles_per_unit\": %.3f}\n", (double) s->cycles / n);
+    } else {
+        printf("\"cycles_per_unit\": null}\n");
+    }
+    fflush(stdout);
+}
+
+// time the current sample, keeping the fastest
+#define TIMED(best, i, body)                                                                       \
+    do {                                                                                           \
+        uint64_t t0 = now_ns();                                                                    \
+        uint64_t c0 = CYCLES();                                                                    \
+        body;                                                                                      \
+        uint64_t c1 = CYCLES();                                                                    \
+        uint64_t t1 = now_ns();                                                                    \
+        if ((i) == 0 || t1 - t0 < (best).ns) {                                                     \
+            (best).ns = t1 - t0;                                                                   \
+            (best).cycles = c1 - c0;                                                               \
+        }                                                                                          \
+    } while (0)
+
+static volatile uint64_t blackhole; // Keeps results of timed loops alive.
+
+// fill a 16 bit trie the way the encoder does, stopping once it is full
+static void fill_trie(TrieNode *root, const uint8_t *buf, size_t len) {
+    TrieNode *curr = root;
+    uint32_t next_code = START_CODE;
+    for (size_t i = 0; i < len && next_code < MAX_CODE(DEFAULT_BITS); i += 1) {
+        TrieNode *next = trie_step(curr, buf[i]);
+        if (next) {
+            curr = next;
+        } else {
+            trie_insert(root, curr, buf[i], next_code);
+            next_code += 1;
+            curr = root;
+        }
+    }
+}
+
+// fill a 16 bit hash table the way the encoder does, stopping once it is full
+static void fill_hash(HashTable *t, const uint8_t *buf, size_t len) {
+    uint32_t curr = EMPTY_CODE;
+    uint32_t next_code = START_CODE;
+    for (size_t i = 0; i < len && next_code < MAX_CODE(DEFAULT_BITS); i += 1) {
+        uint32_t next = hash_step(t, curr, buf[i]);
+        if (next) {
+            curr = next;
+        } else {
+            hash_insert(t, curr, buf[i], next_code);
+            next_code += 1;
+            curr = EMPTY_CODE;
+        }
+    }
+}
+
+// parse buf into the pairs a 16 bit encoder sends, resetting when the trie fills
+// the partial phrase at the end is left out, returns the number of pairs
+static size_t parse_pairs(const uint8_t *buf, size_t len, uint32_t *codes, uint8_t *syms) {
+    TrieNode *root = trie_create();
+    TrieNode *curr = root;
+    uint32_t next_code = START_CODE;
+    size_t n = 0;
+    for (size_t i = 0; root && i < len; i += 1) {
+        TrieNode *next = trie_step(curr, buf[i]);
+        if (next) {
+            curr = next;
+            continue;
+        }
+        codes[n] = curr->code;
+        syms[n] = buf[i];
+        n += 1;
+        trie_insert(root, curr, buf[i], next_code);
+        next_code += 1;
+        curr = root;
+        if (next_code == MAX_CODE(DEFAULT_BITS)) {
+            trie_reset(root);
+            next_code = START_CODE;
+        }
+    }
+    trie_delete(root);
+    return n;
+}
+
+// code widths as the encoder would use them, climbing to 16 bits and wrapping
+static inline int width_at(size_t i) {
+    return get_bitlen(START_CODE + i % (MAX_CODE(DEFAULT_BITS) - START_CODE));
+}
+
+// per-kernel microbenchmarks over the text corpus
+static void micro(const uint8_t *buf, size_t len, int reps) {
+    Sample s = { 0 };
+
+    // trie_step: walk a full dictionary, back to the root on a miss
+    TrieNode *root = trie_create();
+    fill_trie(root, buf, len);
+    for (int r = 0; r < reps; r += 1) {
+        TIMED(s, r, {
+            TrieNode *curr = root;
+            uint64_t sum = 0;
+            for (size_t i = 0; i < len; i += 1) {
+                TrieNode *next = trie_step(curr, buf[i]);
+                curr = next ? next : root;
+                sum += curr->code;
+            }
+            blackhole = sum;
+        });
+    }
+    report("trie_step", "byte", len, &s);
+
+    // trie_reset: rewind a full dictionary
+    uint64_t resets = 0;
+    Sample total = { 0 };
+    for (int r = 0; r < reps; r += 1) {
+        fill_trie(root, buf, len);
+        TIMED(s, 0, trie_reset(root));
+        total.ns += s.ns;
+        total.cycles += s.cycles;
+        resets += 1;
+    }
+    report("trie_reset", "op", resets, &total);
+    trie_delete(root);
+
+    // hash_step: the same walk through a full hash table
+    HashTable *table = hash_create();
+    fill_hash(table, buf, len);
+    for (int r = 0; r < reps; r += 1) {
+        TIMED(s, r, {
+            uint32_t curr = EMPTY_CODE;
+            uint64_t sum = 0;
+            for (size_t i = 0; i < len; i += 1) {
+                uint32_t next = hash_step(table, curr, buf[i]);
+                curr = next ? next : EMPTY_CODE;
+                sum += curr;
+            }
+            blackhole = sum;
+        });
+    }
+    report("hash_step", "byte", len, &s);
+
+    // hash_reset: empty a full hash table
+    resets = 0;
+    memset(&total, 0, sizeof(total));
+    for (int r = 0; r < reps; r += 1) {
+        fill_hash(table, buf, len);
+        TIMED(s, 0, hash_reset(table));
+        total.ns += s.ns;
+        total.cycles += s.cycles;
+        resets += 1;
+    }
+    report("hash_reset", "op", resets, &total);
+    hash_delete(table);
+
+    // wt_add and wt_spell: rebuild the text from its pairs the way the decoder does
+    uint32_t *codes = malloc(len * sizeof(uint32_t));
+    uint8_t *syms = malloc(len);
+    uint8_t *words = malloc(len);
+    WordTable *wt = wt_create(MAX_CODE(DEFAULT_BITS));
+    if (!codes || !syms || !words || !wt) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(1);
+    }
+    size_t pairs = parse_pairs(buf, len, codes, syms);
+    size_t spelled = 0;
+    for (int r = 0; r < reps; r += 1) {
+        TIMED(s, r, {
+            uint32_t next_code = START_CODE;
+            spelled = 0;
+            for (size_t i = 0; i < pairs; i += 1) {
+                wt_add(wt, next_code, codes[i], syms[i]);
+                wt_spell(wt, next_code, words + spelled);
+                spelled += wt[next_code].len;
+                next_code += 1;
+                if (next_code == MAX_CODE(DEFAULT_BITS)) {
+                    wt_reset(wt);
+                    next_code = START_CODE;
+                }
+            }
+            blackhole = words[spelled / 2];
+        });
+    }
+    if (spelled && memcmp(words, buf, spelled) != 0) {
+        fprintf(stderr, "wt_spell spelled the text wrong.\n");
+        exit(1);
+    }
+    report("wt_spell", "byte", spelled, &s);
+    wt_delete(wt);
+    free(codes);
+    free(syms);
+    free(words);
+
+    // write_pair: one pair per input byte at the widths the encoder climbs through
+    PairWriter pw;
+    uint64_t stream_bytes = 0;
+    for (int r = 0; r < reps; r += 1) {
+        pw_init(&pw, null_sink, NULL);
+        TIMED(s, r, {
+            for (size_t i = 0; i < len; i += 1) {
+                write_pair(&pw, i & 0x7F, buf[i], width_at(i));
+            }
+            flush_pairs(&pw);
+        });
+        stream_bytes = (pw.total_bits + 7) / 8;
+    }
+    report("write_pair", "byte", stream_bytes, &s);
+
+    // read_pair: read the same pairs back out of memory
+    Buffer out = { 0 };
+    pw_init(&pw, buffer_sink, &out);
+    for (size_t i = 0; i < len; i += 1) {
+        write_pair(&pw, i & 0x7F, buf[i], width_at(i));
+    }
+    flush_pairs(&pw);
+    for (int r = 0; r < reps; r += 1) {
+        PairReader pr;
+        pr_init(&pr);
+        pr_feed(&pr, out.data, out.len);
+        TIMED(s, r, {
+            uint32_t code = 0;
+            uint8_t sym = 0;
+            uint64_t sum = 0;
+            for (size_t i = 0; i < len && read_pair(&pr, &code, &sym, width_at(i)); i += 1) {
+                sum += code + sym;
+            }
+            blackhole = sum;
+        });
+    }
+    report("read_pair", "byte", out.len, &s);
+    free(out.data);
+}
+
+int main(int argc, char **argv) {
+    size_t size = 16 << 20;
+    int reps = 3;
+    const char *dir = "bench_corpus";
+
+    int opt = 0;
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 's': size = strtoul(optarg, NULL, 10) << 20; break;
+        case 'n': reps = atoi(optarg); break;
+        case 'd': dir = optarg; break;
+        case 'h':
+        default:
+            fprintf(stderr,
+                "SYNOPSIS\n"
+                "   Benchmarks encode, decode and the kernels under them.\n"
+                "   Prints one JSON object per line on stdout.\n\n"
+                "USAGE\n"
+                "   ./lzbench [-h] [-s MB] [-n reps] [-d dir]\n\n"
+                "OPTIONS\n"
+                "   -s MB       Size of each generated corpus (16 by default)\n"
+                "   -n reps     Runs per measurement, the fastest is kept (3 by default)\n"
+                "   -d dir      Where the corpus is generated (bench_corpus by default)\n"
+                "   -h          Display program help and usage\n");
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (size == 0 || reps < 1) {
+        fprintf(stderr, "Corpus size and reps must be at least 1.\n");
+        return 1;
+    }
+    mkdir(dir, 0755);
+
+    char raw[4096], lz[4096], back[4096];
+    for (size_t c = 0; c < sizeof(corpora) / sizeof(corpora[0]); c += 1) {
+        uint8_t *buf = make_corpus(&corpora[c], size);
+        if (!buf) {
+            fprintf(stderr, "Out of memory.\n");
+            return 1;
+        }
+        snprintf(raw, sizeof(raw), "%s/%s", dir, corpora[c].name);
+        snprintf(lz, sizeof(lz), "%s/%s.lz", dir, corpora[c].name);
+        snprintf(back, sizeof(back), "%s/%s.out", dir, corpora[c].name);
+        if (!save(raw, buf, size)) {
+            fprintf(stderr, "Couldn't write %s.\n", raw);
+            return 1;
+        }
+
+        // end to end through the real programs, file to file, once per setting
+        for (size_t e = 0; e < sizeof(settings) / sizeof(settings[0]); e += 1) {
+            const Setting *set = &settings[e];
+            const char *format = NULL;
+            if (strcmp(set->format, "lzw") == 0) {
+                format = "-w";
+            } else if (strcmp(set->format, "huffman") == 0) {
+                format = "-z";
+            }
+            const char *flags[] = { "-e", set->engine, "-r", set->policy, "-l", set->level, format,
+                NULL };
+            Sample enc = { 0 }, dec = { 0 };
+            if (!best_run("./encode", flags, raw, lz, reps, &enc)
+                || !best_run("./decode", NULL, lz, back, reps, &dec)) {
+                fprintf(stderr, "Couldn't run ./encode and ./decode on %s.\n", raw);
+                return 1;
+            }
+            uint64_t comp = file_size(lz);
+            bool ok = same(back, buf, size);
+            printf("{\"bench\": \"e2e\", \"corpus\": \"%s\", \"engine\": \"%s\", "
+                   "\"policy\": \"%s\", \"level\": %s, \"format\": \"%s\", "
+                   "\"bytes\": %zu, \"compressed\": %" PRIu64 ", \"ratio\": %.4f, "
+                   "\"encode_mbps\": %.2f, \"decode_mbps\": %.2f, \"encode_rss_kb\": %ld, "
+                   "\"decode_rss_kb\": %ld, \"roundtrip\": %s}\n",
+                corpora[c].name, set->engine, set->policy, set->level, set->format, size, comp,
+                (double) comp / size, mbps(size, enc.ns), mbps(size, dec.ns), enc.rss_kb,
+                dec.rss_kb, ok ? "true" : "false");
+            fflush(stdout);
+            unlink(back);
+        }
+
+        // kernels run on the text corpus
+        if (c == 0) {
+            micro(buf, size, reps);
+        }
+        free(buf);
+    }
+    return 0;
+}
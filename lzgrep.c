@@ -0,0 +1,558 @@
+#include "lz78.h"
+#include "chunked.h"
+#include "code.h"
+#include "endian.h"
+#include "io.h"
+
+#include <stdio.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define OPTIONS "hbcind:"
+#define MAX_PATTERN 64 // Bytes of pattern, one bit of state each.
+#define INPUT_BLOCK (16 * BLOCK) // Bytes read at a time from input that can't be mapped.
+
+typedef enum Mode {
+    MODE_LINES, // Print matching lines.
+    MODE_COUNT, // Print how many lines match.
+    MODE_OFFSETS, // Print the byte offset of every match.
+} Mode;
+
+/*
+ * Where the pattern meets the word at a code, worked out once per dictionary
+ * entry from the entry it extends, so a word is matched against in a few
+ * instructions however long it is. Bit i stands for pattern[0..i], as in
+ * Shift-And, m being the length of the pattern.
+ */
+typedef struct CodeState {
+    uint64_t ends; // Bit i if the word ends with pattern[0..i].
+    uint64_t within; // Bit i if the whole word is in the pattern, ending at pattern[i].
+    uint64_t crossing; // Bit m - 1 - j if the word starts with the last j bytes of the pattern.
+    uint32_t hit; // Longest prefix of the word, itself included, ending with the pattern.
+    uint32_t epoch; // Dictionary the state belongs to, see Grep.
+    uint32_t lines; // Newlines in the word.
+    uint32_t tail; // Symbols after its last newline, all of them without one.
+} CodeState;
+
+// the end of a word on the current line, spelled only if the line is printed
+typedef struct Piece {
+    uint32_t prefix;
+    uint8_t sym;
+    uint32_t skip; // Symbols of the word on lines before.
+} Piece;
+
+// input read in order, from a mapping where there is one
+typedef struct Input {
+    int infile;
+    Mapping map;
+    bool mapped;
+    size_t at; // Bytes of the mapping taken.
+    uint8_t block[INPUT_BLOCK];
+} Input;
+
+typedef struct Grep {
+    uint64_t masks[256]; // Bit i of masks[a] if pattern[i] is a.
+    uint64_t found; // Bit m - 1, the whole pattern.
+    int m;
+    Mode mode;
+    bool numbers; // Print line numbers.
+    const char *name; // Printed ahead of each line if there's more than one file, else NULL.
+    // states of every code, valid in the epoch they were worked out in
+    // a reset starts a new epoch, so nothing is cleared
+    CodeState *states;
+    uint32_t *stack; // Codes waiting on their prefix's state.
+    uint32_t size; // Codes states has room for.
+    uint32_t spare; // max_code, reused for every word of a frozen dictionary.
+    uint32_t epoch;
+    const WordTable *table;
+    // the scan so far
+    uint64_t state; // Prefixes of the pattern the output so far ends with.
+    uint64_t pos; // Offset in the output of the next word.
+    uint64_t line; // Number of the current line.
+    bool matched; // The current line has a match.
+    Buffer text; // Start of the current line, ahead of the pieces.
+    Piece *pieces;
+    size_t piece_count;
+    size_t piece_cap;
+    Buffer spelled; // Words spelled out to be scanned a byte at a time.
+    uint64_t count; // Matching lines, or matches with MODE_OFFSETS.
+} Grep;
+
+// give up on running out of memory, there's no sensible way to carry on
+static void *check_alloc(void *p) {
+    if (!p) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(2);
+    }
+    return p;
+}
+
+// room for at least len bytes in buf
+static uint8_t *reserve(Buffer *buf, size_t len) {
+    if (!buffer_reserve(buf, len)) {
+        check_alloc(NULL);
+    }
+    return buf->data;
+}
+
+// start a new dictionary, earlier states are left to go stale
+static void next_epoch(Grep *g) {
+    if (g->epoch == UINT32_MAX) {
+        memset(g->states, 0, (size_t) g->size * sizeof(CodeState));
+        g->epoch = 0;
+    }
+    g->epoch += 1;
+}
+
+// room for the states of codes up to max_code
+static void size_states(Grep *g, uint32_t max_code) {
+    if (g->size < max_code + 1) {
+        free(g->states);
+        free(g->stack);
+        g->states = check_alloc(calloc(max_code + 1, sizeof(CodeState)));
+        g->stack = check_alloc(malloc((size_t) (max_code + 1) * sizeof(uint32_t)));
+        g->size = max_code + 1;
+        // EMPTY_CODE has nothing in it, its state is never worked out
+        g->states[EMPTY_CODE].hit = EMPTY_CODE;
+        g->epoch = 0;
+    }
+    g->spare = max_code;
+    next_epoch(g);
+}
+
+// work out the state of code from the state of its prefix
+static void fill_state(Grep *g, const WordTable *table, uint32_t code) {
+    const WordEntry *e = &table[code];
+    const CodeState *p = &g->states[e->prefix];
+    CodeState *s = &g->states[code];
+    uint64_t mask = g->masks[e->sym];
+    s->ends = ((p->ends << 1) | 1) & mask;
+    // the empty word is in the pattern everywhere, ending at pattern[-1] too
+    s->within = (e->prefix == EMPTY_CODE ? mask : (p->within << 1) & mask);
+    s->crossing = p->crossing;
+    if (e->len < (uint32_t) g->m && s->within & g->found) {
+        s->crossing |= g->found >> e->len;
+    }
+    s->hit = s->ends & g->found ? code : p->hit;
+    s->lines = p->lines + (e->sym == '\n');
+    s->tail = e->sym == '\n' ? 0 : p->tail + 1;
+    s->epoch = g->epoch;
+}
+
+// state of the word at code, working out those of its prefixes first where they're stale
+static inline const CodeState *code_state(Grep *g, const WordTable *table, uint32_t code) {
+    CodeState *s = &g->states[code];
+    if (s->epoch == g->epoch && code != g->spare) {
+        return s;
+    }
+    uint32_t n = 0;
+    uint32_t c = code;
+    while (c != EMPTY_CODE && (g->states[c].epoch != g->epoch || c == g->spare)) {
+        g->stack[n] = c;
+        n += 1;
+        c = table[c].prefix;
+    }
+    while (n > 0) {
+        n -= 1;
+        fill_state(g, table, g->stack[n]);
+    }
+    return s;
+}
+
+// spell out the pieces after the text, they'd go stale with the dictionary
+static void spell_pieces(Grep *g) {
+    for (size_t i = 0; i < g->piece_count; i += 1) {
+        const Piece *p = &g->pieces[i];
+        uint32_t len = g->table[p->prefix].len;
+        uint8_t *out = reserve(&g->text, g->text.len + len + 1) + g->text.len;
+        wt_spell(g->table, p->prefix, out);
+        out[len] = p->sym;
+        memmove(out, out + p->skip, len + 1 - p->skip);
+        g->text.len += len + 1 - p->skip;
+    }
+    g->piece_count = 0;
+}
+
+static void add_piece(Grep *g, uint32_t prefix, uint8_t sym, uint32_t skip) {
+    if (g->piece_count == g->piece_cap) {
+        g->piece_cap = g->piece_cap ? 2 * g->piece_cap : 64;
+        g->pieces = check_alloc(realloc(g->pieces, g->piece_cap * sizeof(Piece)));
+    }
+    g->pieces[g->piece_count] = (Piece) { prefix, sym, skip };
+    g->piece_count += 1;
+}
+
+static void print_offset(Grep *g, uint64_t offset) {
+    if (g->name) {
+        printf("%s:", g->name);
+    }
+    printf("%" PRIu64 "\n", offset);
+    g->count += 1;
+}
+
+// the current line ends with the len bytes at tail, print it if it matched
+static void end_line(Grep *g, const uint8_t *tail, size_t len) {
+    if (g->matched) {
+        g->count += 1;
+        if (g->mode == MODE_LINES) {
+            spell_pieces(g);
+            if (g->name) {
+                printf("%s:", g->name);
+            }
+            if (g->numbers) {
+                printf("%" PRIu64 ":", g->line);
+            }
+            if (g->text.len) {
+                fwrite(g->text.data, 1, g->text.len, stdout);
+            }
+            if (len) {
+                fwrite(tail, 1, len, stdout);
+            }
+            putchar('\n');
+        }
+    }
+    g->line += 1;
+    g->matched = false;
+    g->text.len = 0;
+    g->piece_count = 0;
+}
+
+// Shift-And over output that is at hand byte by byte, stored blocks and words with newlines
+static void scan_bytes(Grep *g, const uint8_t *buf, size_t len) {
+    uint64_t state = g->state;
+    size_t start = 0; // Where the current line starts in buf.
+    for (size_t i = 0; i < len; i += 1) {
+        state = ((state << 1) | 1) & g->masks[buf[i]];
+        if (state & g->found) {
+            if (g->mode == MODE_OFFSETS) {
+                print_offset(g, g->pos + i + 1 - g->m);
+            } else {
+                g->matched = true;
+            }
+        }
+        if (buf[i] == '\n' && g->mode != MODE_OFFSETS) {
+            end_line(g, buf + start, i - start);
+            start = i + 1;
+        }
+    }
+    if (g->mode == MODE_LINES && start < len) {
+        spell_pieces(g);
+        uint8_t *out = reserve(&g->text, g->text.len + len - start) + g->text.len;
+        memcpy(out, buf + start, len - start);
+        g->text.len += len - start;
+    }
+    g->state = state;
+    g->pos += len;
+}
+
+// print the offsets of the matches ending in the word at code, in order
+// those that start ahead of it come first, then those inside it, shortest prefix first
+static void word_offsets(Grep *g, const WordTable *table, const CodeState *s) {
+    uint64_t crossing = g->state & s->crossing;
+    while (crossing) {
+        int bit = 63 - __builtin_clzll(crossing);
+        crossing &= ~(UINT64_C(1) << bit);
+        // the word starts with the last m - 1 - bit bytes of the pattern
+        print_offset(g, g->pos - bit - 1);
+    }
+    uint32_t n = 0;
+    for (uint32_t c = s->hit; c != EMPTY_CODE; c = g->states[table[c].prefix].hit) {
+        g->stack[n] = table[c].len;
+        n += 1;
+    }
+    while (n > 0) {
+        n -= 1;
+        print_offset(g, g->pos + g->stack[n] - g->m);
+    }
+}
+
+// the next word of the output
+static void on_phrase(void *ctx, const WordTable *table, uint32_t code) {
+    Grep *g = ctx;
+    g->table = table;
+    const CodeState *s = code_state(g, table, code);
+    uint32_t len = table[code].len;
+    bool match = g->state & s->crossing || s->hit != EMPTY_CODE;
+    if (g->mode == MODE_OFFSETS) {
+        if (match) {
+            word_offsets(g, table, s);
+        }
+    } else if (s->lines && (match || g->matched)) {
+        // a line to report ends inside the word, which one takes its symbols
+        uint8_t *out = reserve(&g->spelled, len);
+        wt_spell(table, code, out);
+        scan_bytes(g, out, len);
+        return;
+    } else if (s->lines) {
+        // lines without a match end in the word, the last one starts in it
+        g->line += s->lines;
+        g->text.len = 0;
+        g->piece_count = 0;
+    } else {
+        g->matched = g->matched || match;
+    }
+    g->state = (len < 64 ? (g->state << len) & s->within : 0) | s->ends;
+    g->pos += len;
+    if (g->mode == MODE_LINES && s->tail) {
+        add_piece(g, table[code].prefix, table[code].sym, len - s->tail);
+    }
+}
+
+static void on_stored(void *ctx, const uint8_t *buf, size_t len) {
+    scan_bytes(ctx, buf, len);
+}
+
+// the dictionary starts over, pieces of the line so far are spelled while they still can be
+static void on_reset(void *ctx) {
+    Grep *g = ctx;
+    if (g->mode == MODE_LINES) {
+        spell_pieces(g);
+    }
+    next_epoch(g);
+}
+
+// points *buf at up to len bytes of the input, returns how many, 0 at its end
+static size_t take(Input *in, const uint8_t **buf, size_t len) {
+    if (in->mapped) {
+        size_t n = in->map.len - in->at < len ? in->map.len - in->at : len;
+        *buf = in->map.data + in->at;
+        in->at += n;
+        return n;
+    }
+    int n = read_bytes(in->infile, in->block, len < INPUT_BLOCK ? len : INPUT_BLOCK);
+    *buf = in->block;
+    return n > 0 ? n : 0;
+}
+
+// copy exactly len bytes of the input to out
+static bool take_exact(Input *in, uint8_t *out, size_t len) {
+    while (len > 0) {
+        const uint8_t *buf = NULL;
+        size_t n = take(in, &buf, len);
+        if (n == 0) {
+            return false;
+        }
+        memcpy(out, buf, n);
+        out += n;
+        len -= n;
+    }
+    return true;
+}
+
+// search one LZ78 stream, head holds its first HEADER_SIZE bytes and at most left follow them
+// the whole header is fed ahead of the codes, so states are sized before the first word
+static LZ78Status grep_stream(Grep *g, LZ78Decoder *dec, Input *in, uint8_t *head, uint64_t left) {
+    FileHeader header;
+    read_header(head, &header);
+    int head_size = header.magic == MAGIC ? header_size(header.flags) : HEADER_SIZE;
+    int rest = head_size - HEADER_SIZE;
+    if ((uint64_t) rest > left || !take_exact(in, head + HEADER_SIZE, rest)) {
+        return LZ78_ERR_TRUNCATED;
+    }
+    left -= rest;
+    LZ78Status status = lz78_decoder_update(dec, head, head_size);
+    if (status != LZ78_OK) {
+        return status;
+    }
+    int bits = header.bits ? header.bits : DEFAULT_BITS;
+    size_states(g, MAX_CODE(bits));
+
+    const uint8_t *buf = NULL;
+    size_t n = 0;
+    while (status == LZ78_OK && left > 0 && (n = take(in, &buf, left)) > 0) {
+        status = lz78_decoder_update(dec, buf, n);
+        left -= n;
+    }
+    if (status == LZ78_OK) {
+        status = lz78_decoder_finish(dec);
+    }
+    // the next stream reuses the table
+    if (g->mode == MODE_LINES) {
+        spell_pieces(g);
+    }
+    return status;
+}
+
+// search a compressed file, a single stream or a chunked container
+static LZ78Status grep_file(Grep *g, int infile, const LZ78Dict *dict) {
+    uint8_t head[HEADER_MAX];
+    if (read_bytes(infile, head, HEADER_SIZE) != HEADER_SIZE) {
+        return LZ78_ERR_TRUNCATED;
+    }
+    Input *in = check_alloc(calloc(1, sizeof(Input)));
+    in->infile = infile;
+    in->mapped = map_file(infile, &in->map);
+    const LZ78Phrases phrases = { on_phrase, on_stored, on_reset, g };
+    LZ78Decoder *dec = check_alloc(lz78_decoder_create(null_sink, NULL));
+    lz78_decoder_use_dict(dec, dict);
+    lz78_decoder_phrases(dec, &phrases);
+    g->state = 0;
+    g->pos = 0;
+    g->line = 1;
+    g->matched = false;
+    g->text.len = 0;
+    g->piece_count = 0;
+    g->count = 0;
+
+    LZ78Status status = LZ78_OK;
+    FileHeader header;
+    read_header(head, &header);
+    if (header.magic == MAGIC_CHUNKED) {
+        // chunks are streams of their own, one after the other in the output
+        uint8_t size[4];
+        uint8_t frame[FRAME_SIZE];
+        if (!take_exact(in, size, sizeof(size))) {
+            status = LZ78_ERR_TRUNCATED;
+        }
+        while (status == LZ78_OK) {
+            if (!take_exact(in, frame, FRAME_SIZE)) {
+                status = LZ78_ERR_TRUNCATED;
+                break;
+            }
+            uint32_t comp_len = load_le32(frame + 4);
+            if (load_le32(frame) == 0 && comp_len == 0) {
+                break;
+            }
+            if (comp_len < HEADER_SIZE || !take_exact(in, head, HEADER_SIZE)) {
+                status = LZ78_ERR_TRUNCATED;
+                break;
+            }
+            lz78_decoder_restart(dec, null_sink, NULL);
+            status = grep_stream(g, dec, in, head, comp_len - HEADER_SIZE);
+        }
+    } else {
+        status = grep_stream(g, dec, in, head, UINT64_MAX);
+    }
+    // the last line needn't end with a newline
+    if (status == LZ78_OK && g->mode != MODE_OFFSETS && g->matched) {
+        end_line(g, NULL, 0);
+    }
+    lz78_decoder_delete(dec);
+    if (in->mapped) {
+        unmap_file(&in->map);
+    }
+    free(in);
+    return status;
+}
+
+int main(int argc, char **argv) {
+    Grep *g = check_alloc(calloc(1, sizeof(Grep)));
+    bool nocase = false;
+    bool counts = false;
+    bool offsets = false;
+    LZ78Dict *dict = NULL;
+    int dictfile = -1;
+
+    int opt = 0;
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 'b': offsets = true; break;
+        case 'c': counts = true; break;
+        case 'i': nocase = true; break;
+        case 'n': g->numbers = true; break;
+        case 'd':
+            dictfile = open(optarg, O_RDONLY);
+            dict = dictfile == -1 ? NULL : lz78_dict_read(dictfile);
+            if (!dict) {
+                fprintf(stderr, "Couldn't load dictionary %s.\n", optarg);
+                exit(2);
+            }
+            close(dictfile);
+            break;
+        case 'h':
+        default:
+            fprintf(stderr,
+                "SYNOPSIS\n"
+                "   Searches files compressed by encode for a fixed string, without\n"
+                "   decompressing them. Exits with 0 if there's a match, 1 if there\n"
+                "   isn't and 2 if a file couldn't be searched.\n\n"
+                "USAGE\n"
+                "   ./lzgrep [-bcinh] [-d dict] pattern [file.lz...]\n\n"
+                "OPTIONS\n"
+                "   -b          Print the byte offset of every match instead of lines\n"
+                "   -c          Print how many lines match instead of the lines\n"
+                "   -i          Ignore the case of ASCII letters\n"
+                "   -n          Print the line number ahead of each line\n"
+                "   -d dict     Dictionary the input was compressed with\n"
+                "   -h          Display program help and usage\n");
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (optind == argc) {
+        fprintf(stderr, "Need a pattern to search for.\n");
+        exit(2);
+    }
+    if (offsets && (counts || g->numbers)) {
+        fprintf(stderr, "Offsets are of matches, not lines, -b can't go with -c or -n.\n");
+        exit(2);
+    }
+    g->mode = offsets ? MODE_OFFSETS : counts ? MODE_COUNT : MODE_LINES;
+
+    // a bit of state per byte of the pattern
+    const char *pattern = argv[optind];
+    size_t m = strlen(pattern);
+    if (m == 0 || m > MAX_PATTERN) {
+        fprintf(stderr, "Pattern must be 1 to %d bytes.\n", MAX_PATTERN);
+        exit(2);
+    }
+    if (g->mode != MODE_OFFSETS && memchr(pattern, '\n', m)) {
+        fprintf(stderr, "Lines can't match a pattern with a newline, only -b can.\n");
+        exit(2);
+    }
+    g->m = m;
+    g->found = UINT64_C(1) << (m - 1);
+    for (size_t i = 0; i < m; i += 1) {
+        uint8_t a = pattern[i];
+        g->masks[a] |= UINT64_C(1) << i;
+        if (nocase) {
+            g->masks[tolower(a)] |= UINT64_C(1) << i;
+            g->masks[toupper(a)] |= UINT64_C(1) << i;
+        }
+    }
+
+    // stdin without any files, names ahead of lines with more than one
+    int files = argc - optind - 1;
+    bool any = false;
+    bool failed = false;
+    for (int f = 0; f < (files ? files : 1); f += 1) {
+        const char *name = files ? argv[optind + 1 + f] : "(standard input)";
+        int infile = files ? open(name, O_RDONLY) : 0;
+        if (infile == -1) {
+            fprintf(stderr, "Couldn't open %s.\n", name);
+            failed = true;
+            continue;
+        }
+        g->name = files > 1 ? name : NULL;
+        LZ78Status status = grep_file(g, infile, dict);
+        if (files) {
+            close(infile);
+        }
+        if (g->mode == MODE_COUNT) {
+            if (g->name) {
+                printf("%s:", g->name);
+            }
+            printf("%" PRIu64 "\n", g->count);
+        }
+        any = any || g->count > 0;
+        if (status != LZ78_OK) {
+            fflush(stdout);
+            fprintf(stderr, "%s: %s.\n", name, lz78_strerror(status));
+            failed = true;
+        }
+    }
+    fflush(stdout);
+
+    lz78_dict_delete(dict);
+    free(g->states);
+    free(g->stack);
+    free(g->text.data);
+    free(g->pieces);
+    free(g->spelled.data);
+    free(g);
+    return failed ? 2 : any ? 0 : 1;
+}
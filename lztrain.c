@@ -0,0 +1,160 @@
+#include "lz78.h"
+#include "io.h"
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define OPTIONS "hln:o:"
+
+// growable list of samples
+typedef struct Samples {
+    const uint8_t **data;
+    size_t *lens;
+    size_t count;
+    size_t cap;
+} Samples;
+
+// add a sample to the list
+static bool add_sample(Samples *s, const uint8_t *data, size_t len) {
+    if (s->count == s->cap) {
+        size_t cap = s->cap ? s->cap * 2 : 64;
+        const uint8_t **data_grown = realloc(s->data, cap * sizeof(uint8_t *));
+        if (data_grown) {
+            s->data = data_grown;
+        }
+        size_t *lens_grown = realloc(s->lens, cap * sizeof(size_t));
+        if (lens_grown) {
+            s->lens = lens_grown;
+        }
+        if (!data_grown || !lens_grown) {
+            return false;
+        }
+        s->cap = cap;
+    }
+    s->data[s->count] = data;
+    s->lens[s->count] = len;
+    s->count += 1;
+    return true;
+}
+
+// read all of infile into a buffer
+static bool slurp(int infile, Buffer *in) {
+    uint8_t block[BLOCK];
+    int bytes_read = 0;
+    while ((bytes_read = read_bytes(infile, block, BLOCK)) > 0) {
+        if (!buffer_sink(in, block, bytes_read)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    uint32_t entries = DICT_ENTRIES;
+    bool lines = false;
+    int outfile = -1;
+
+    int opt = 0;
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 'l': lines = true; break;
+        case 'n':
+            entries = strtoul(optarg, NULL, 10);
+            if (entries == 0) {
+                fprintf(stderr, "Dictionary must have at least 1 entry.\n");
+                exit(1);
+            }
+            break;
+        case 'o':
+            outfile = open(optarg, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (outfile == -1) {
+                perror("Couldn't open output file!\n");
+                exit(1);
+            }
+            break;
+        case 'h':
+        default:
+            fprintf(stderr,
+                "SYNOPSIS\n"
+                "   Trains an LZ78 dictionary on sample files.\n"
+                "   Inputs compressed and decompressed with -d dict start from it.\n\n"
+                "USAGE\n"
+                "   ./lztrain [-hl] [-n entries] -o dict sample...\n\n"
+                "OPTIONS\n"
+                "   -l          Treat every line of a sample file as a sample of its own\n"
+                "   -n entries  Entries to keep (%d by default)\n"
+                "   -o dict     Specify the dictionary file to write\n"
+                "   -h          Display program help and usage\n",
+                DICT_ENTRIES);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (outfile == -1 || optind == argc) {
+        fprintf(stderr, "Need a dictionary file with -o and at least one sample.\n");
+        exit(1);
+    }
+
+    // sample files stay loaded until the dictionary is written
+    int files = argc - optind;
+    Buffer *loaded = calloc(files, sizeof(Buffer));
+    Samples samples = { 0 };
+    if (!loaded) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(1);
+    }
+    for (int f = 0; f < files; f += 1) {
+        int infile = open(argv[optind + f], O_RDONLY);
+        if (infile == -1 || !slurp(infile, &loaded[f])) {
+            fprintf(stderr, "Couldn't read sample %s.\n", argv[optind + f]);
+            exit(1);
+        }
+        close(infile);
+        const uint8_t *data = loaded[f].data;
+        size_t len = loaded[f].len;
+        bool ok = true;
+        if (lines) {
+            // each line, newline included, is a sample
+            size_t start = 0;
+            for (size_t i = 0; i < len && ok; i += 1) {
+                if (data[i] == '\n' || i == len - 1) {
+                    ok = add_sample(&samples, data + start, i + 1 - start);
+                    start = i + 1;
+                }
+            }
+        } else if (len > 0) {
+            ok = add_sample(&samples, data, len);
+        }
+        if (!ok) {
+            fprintf(stderr, "Out of memory.\n");
+            exit(1);
+        }
+    }
+
+    uint8_t *dict = NULL;
+    size_t dict_len = 0;
+    LZ78Status status
+        = lz78_dict_train(samples.data, samples.lens, samples.count, entries, &dict, &dict_len);
+    if (status != LZ78_OK) {
+        fprintf(stderr, "%s.\n", lz78_strerror(status));
+        exit(1);
+    }
+    if (write_bytes(outfile, dict, dict_len) != (int) dict_len) {
+        fprintf(stderr, "Couldn't write dictionary.\n");
+        exit(1);
+    }
+    close(outfile);
+    size_t trained = (dict_len - DICT_HEAD_SIZE) / DICT_ENTRY_SIZE;
+    fprintf(stderr, "Trained %zu entries on %zu samples.\n", trained, samples.count);
+
+    free(dict);
+    for (int f = 0; f < files; f += 1) {
+        free(loaded[f].data);
+    }
+    free(loaded);
+    free(samples.data);
+    free(samples.lens);
+    return 0;
+}
@@ -0,0 +1,252 @@
+#include "io.h"
+#include "pipeline.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// a ring of fixed size blocks passed from a producer to a consumer thread
+typedef struct Ring {
+    uint8_t *data;
+    size_t *lens;
+    int depth;
+    int head; // Next full slot to consume.
+    int tail; // Next empty slot to fill.
+    int count; // Full slots.
+    bool closed; // Producer is done or consumer gave up.
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} Ring;
+
+struct Pipeline {
+    Ring in;
+    Ring out;
+    int infile;
+    int outfile;
+    pthread_t reader;
+    pthread_t writer;
+    bool holding; // Codec holds the head slot of in.
+    uint8_t *out_slot; // Output slot being filled by the codec, NULL if none.
+    size_t out_len;
+    bool error; // Set by the writer if output couldn't be written, read atomically.
+};
+
+// set up a ring of depth empty slots
+static bool ring_init(Ring *r, int depth) {
+    r->data = malloc((size_t) depth * PIPE_BLOCK);
+    r->lens = calloc(depth, sizeof(size_t));
+    if (!r->data || !r->lens) {
+        free(r->data);
+        free(r->lens);
+        return false;
+    }
+    r->depth = depth;
+    r->head = 0;
+    r->tail = 0;
+    r->count = 0;
+    r->closed = false;
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->not_empty, NULL);
+    pthread_cond_init(&r->not_full, NULL);
+    return true;
+}
+
+// free a ring
+static void ring_free(Ring *r) {
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->not_empty);
+    pthread_cond_destroy(&r->not_full);
+    free(r->data);
+    free(r->lens);
+}
+
+// wait for an empty slot to fill, NULL if the ring was closed
+static uint8_t *ring_empty_slot(Ring *r) {
+    pthread_mutex_lock(&r->lock);
+    while (r->count == r->depth && !r->closed) {
+        pthread_cond_wait(&r->not_full, &r->lock);
+    }
+    uint8_t *slot = r->closed ? NULL : r->data + (size_t) r->tail * PIPE_BLOCK;
+    pthread_mutex_unlock(&r->lock);
+    return slot;
+}
+
+// pass the slot being filled on to the consumer
+static void ring_commit(Ring *r, size_t len) {
+    pthread_mutex_lock(&r->lock);
+    r->lens[r->tail] = len;
+    r->tail = (r->tail + 1) % r->depth;
+    r->count += 1;
+    pthread_cond_signal(&r->not_empty);
+    pthread_mutex_unlock(&r->lock);
+}
+
+// wait for a full slot, NULL once the ring is closed and drained
+static uint8_t *ring_full_slot(Ring *r, size_t *len) {
+    pthread_mutex_lock(&r->lock);
+    while (r->count == 0 && !r->closed) {
+        pthread_cond_wait(&r->not_empty, &r->lock);
+    }
+    uint8_t *slot = NULL;
+    if (r->count > 0) {
+        slot = r->data + (size_t) r->head * PIPE_BLOCK;
+        *len = r->lens[r->head];
+    }
+    pthread_mutex_unlock(&r->lock);
+    return slot;
+}
+
+// hand the consumed slot back to the producer
+static void ring_release(Ring *r) {
+    pthread_mutex_lock(&r->lock);
+    r->head = (r->head + 1) % r->depth;
+    r->count -= 1;
+    pthread_cond_signal(&r->not_full);
+    pthread_mutex_unlock(&r->lock);
+}
+
+// no more slots will be committed, or taken if the consumer gave up
+static void ring_close(Ring *r) {
+    pthread_mutex_lock(&r->lock);
+    r->closed = true;
+    pthread_cond_broadcast(&r->not_empty);
+    pthread_cond_broadcast(&r->not_full);
+    pthread_mutex_unlock(&r->lock);
+}
+
+// reader thread: fill input slots until the end of input
+static void *reader(void *ctx) {
+    Pipeline *p = ctx;
+    uint8_t *slot = NULL;
+    while ((slot = ring_empty_slot(&p->in))) {
+        int bytes_read = read_bytes(p->infile, slot, PIPE_BLOCK);
+        if (bytes_read > 0) {
+            ring_commit(&p->in, bytes_read);
+        }
+        if (bytes_read < PIPE_BLOCK) {
+            break;
+        }
+    }
+    ring_close(&p->in);
+    return NULL;
+}
+
+// whether the writer has failed, the codec checks from its own thread
+static bool failed(Pipeline *p) {
+    return __atomic_load_n(&p->error, __ATOMIC_ACQUIRE);
+}
+
+// writer thread: drain output slots until the codec is done
+static void *writer(void *ctx) {
+    Pipeline *p = ctx;
+    uint8_t *slot = NULL;
+    size_t len = 0;
+    while ((slot = ring_full_slot(&p->out, &len))) {
+        if (!failed(p) && write_bytes(p->outfile, slot, len) != (int) len) {
+            __atomic_store_n(&p->error, true, __ATOMIC_RELEASE);
+        }
+        ring_release(&p->out);
+    }
+    return NULL;
+}
+
+// constructor for a pipeline
+Pipeline *pipeline_create(int infile, int outfile, int depth) {
+    if (depth < 2) {
+        depth = 2;
+    }
+    Pipeline *p = calloc(1, sizeof(Pipeline));
+    if (!p) {
+        return NULL;
+    }
+    if (!ring_init(&p->in, depth)) {
+        free(p);
+        return NULL;
+    }
+    if (!ring_init(&p->out, depth)) {
+        ring_free(&p->in);
+        free(p);
+        return NULL;
+    }
+    p->infile = infile;
+    p->outfile = outfile;
+    if (pthread_create(&p->reader, NULL, reader, p) != 0) {
+        ring_free(&p->in);
+        ring_free(&p->out);
+        free(p);
+        return NULL;
+    }
+    if (pthread_create(&p->writer, NULL, writer, p) != 0) {
+        ring_close(&p->in);
+        pthread_join(p->reader, NULL);
+        ring_free(&p->in);
+        ring_free(&p->out);
+        free(p);
+        return NULL;
+    }
+    return p;
+}
+
+// next block of input for the codec
+size_t pipeline_next(Pipeline *p, const uint8_t **buf) {
+    // done with the last block, give it back to the reader
+    if (p->holding) {
+        ring_release(&p->in);
+        p->holding = false;
+    }
+    size_t len = 0;
+    uint8_t *slot = ring_full_slot(&p->in, &len);
+    if (!slot) {
+        return 0;
+    }
+    p->holding = true;
+    *buf = slot;
+    return len;
+}
+
+// sink copying output into slots for the writer
+bool pipeline_sink(void *ctx, const uint8_t *buf, size_t len) {
+    Pipeline *p = ctx;
+    while (len > 0 && !failed(p)) {
+        // start on a new slot if there isn't one
+        if (!p->out_slot) {
+            p->out_slot = ring_empty_slot(&p->out);
+            p->out_len = 0;
+        }
+        size_t take = PIPE_BLOCK - p->out_len;
+        if (take > len) {
+            take = len;
+        }
+        memcpy(p->out_slot + p->out_len, buf, take);
+        p->out_len += take;
+        buf += take;
+        len -= take;
+        // full slot goes to the writer
+        if (p->out_len == PIPE_BLOCK) {
+            ring_commit(&p->out, p->out_len);
+            p->out_slot = NULL;
+        }
+    }
+    return !failed(p);
+}
+
+// destructor for a pipeline
+bool pipeline_finish(Pipeline *p) {
+    // queue what's left of the output and let the writer drain it
+    if (p->out_slot && p->out_len > 0) {
+        ring_commit(&p->out, p->out_len);
+    }
+    ring_close(&p->out);
+    pthread_join(p->writer, NULL);
+    // stop the reader, it may still be waiting for room if the codec gave up early
+    ring_close(&p->in);
+    pthread_join(p->reader, NULL);
+    bool ok = !failed(p);
+    ring_free(&p->in);
+    ring_free(&p->out);
+    free(p);
+    return ok;
+}
@@ -0,0 +1,43 @@
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+#include "io.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PIPE_BLOCK (16 * BLOCK) // Bytes per ring slot, 16 I/O blocks.
+#define PIPE_DEPTH 8 // Slots per ring by default.
+
+typedef struct Pipeline Pipeline;
+
+/*
+ * Constructor: Starts a reader thread filling a ring of depth input blocks
+ * from infile and a writer thread draining a ring of depth output blocks
+ * to outfile
+ * The codec runs on the calling thread between pipeline_next() and
+ * pipeline_sink()
+ * Returns NULL if the rings or threads couldn't be set up
+ */
+Pipeline *pipeline_create(int infile, int outfile, int depth);
+
+/*
+ * Hands the codec the next block of input at *buf
+ * The block stays valid until the next call
+ * Returns the length of the block, 0 at the end of input
+ */
+size_t pipeline_next(Pipeline *p, const uint8_t **buf);
+
+/*
+ * Sink that queues output for the writer thread of the Pipeline at ctx
+ */
+bool pipeline_sink(void *ctx, const uint8_t *buf, size_t len);
+
+/*
+ * Destructor: Queues the last output, waits for the writer to drain it,
+ * stops both threads and frees the pipeline
+ * Returns false if any output couldn't be written
+ */
+bool pipeline_finish(Pipeline *p);
+
+#endif
@@ -0,0 +1,129 @@
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct Pool {
+    pthread_t *threads;
+    int size;
+    pthread_mutex_t lock;
+    pthread_cond_t work; // Signalled when a batch starts or the pool stops.
+    pthread_cond_t done; // Signalled when the last job of a batch finishes.
+    Job job;
+    void *arg;
+    int n; // Jobs in the current batch.
+    int next; // Next job to hand out.
+    int finished; // Jobs of the batch that are done.
+    unsigned batch; // Bumped for each batch so workers see new ones.
+    bool stop;
+};
+
+// worker loop: take jobs of the current batch until there are none left
+static void *worker(void *ctx) {
+    Pool *p = ctx;
+    unsigned seen = 0;
+    pthread_mutex_lock(&p->lock);
+    while (true) {
+        // wait for a new batch or the pool to stop
+        while (!p->stop && (p->batch == seen || p->next == p->n)) {
+            pthread_cond_wait(&p->work, &p->lock);
+        }
+        if (p->stop) {
+            break;
+        }
+        seen = p->batch;
+        // take jobs until the batch is handed out
+        while (p->next < p->n) {
+            int i = p->next;
+            p->next += 1;
+            pthread_mutex_unlock(&p->lock);
+            p->job(p->arg, i);
+            pthread_mutex_lock(&p->lock);
+            p->finished += 1;
+            if (p->finished == p->n) {
+                pthread_cond_signal(&p->done);
+            }
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+// constructor for a pool
+Pool *pool_create(int threads) {
+    if (threads < 1) {
+        threads = 1;
+    }
+    Pool *p = calloc(1, sizeof(Pool));
+    if (!p) {
+        return NULL;
+    }
+    p->threads = calloc(threads, sizeof(pthread_t));
+    if (!p->threads) {
+        free(p);
+        return NULL;
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->work, NULL);
+    pthread_cond_init(&p->done, NULL);
+    // start the workers, stopping the ones already running on failure
+    for (int i = 0; i < threads; i += 1) {
+        if (pthread_create(&p->threads[i], NULL, worker, p) != 0) {
+            p->size = i;
+            pool_delete(p);
+            return NULL;
+        }
+    }
+    p->size = threads;
+    return p;
+}
+
+// run a batch of n jobs and wait for them
+void pool_run(Pool *p, Job job, void *arg, int n) {
+    if (n <= 0) {
+        return;
+    }
+    pthread_mutex_lock(&p->lock);
+    p->job = job;
+    p->arg = arg;
+    p->n = n;
+    p->next = 0;
+    p->finished = 0;
+    p->batch += 1;
+    pthread_cond_broadcast(&p->work);
+    while (p->finished < p->n) {
+        pthread_cond_wait(&p->done, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+// workers in the pool
+int pool_size(Pool *p) {
+    return p->size;
+}
+
+// online CPUs
+int pool_cpus(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int) cpus : 1;
+}
+
+// destructor for a pool
+void pool_delete(Pool *p) {
+    if (p) {
+        pthread_mutex_lock(&p->lock);
+        p->stop = true;
+        pthread_cond_broadcast(&p->work);
+        pthread_mutex_unlock(&p->lock);
+        for (int i = 0; i < p->size; i += 1) {
+            pthread_join(p->threads[i], NULL);
+        }
+        pthread_mutex_destroy(&p->lock);
+        pthread_cond_destroy(&p->work);
+        pthread_cond_destroy(&p->done);
+        free(p->threads);
+        free(p);
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef __POOL_H__
+#define __POOL_H__
+
+typedef struct Pool Pool;
+
+/*
+ * Runs job i of a batch, arg is shared by every job of the batch
+ */
+typedef void (*Job)(void *arg, int i);
+
+/*
+ * Constructor: Starts a pool of threads worker threads
+ * Returns NULL if the threads couldn't be started
+ */
+Pool *pool_create(int threads);
+
+/*
+ * Runs job(arg, i) for every i in [0, n) on the workers
+ * Returns once all n jobs are done
+ */
+void pool_run(Pool *p, Job job, void *arg, int n);
+
+/*
+ * Returns the number of worker threads in the pool
+ */
+int pool_size(Pool *p);
+
+/*
+ * Returns the number of online CPUs, at least 1
+ */
+int pool_cpus(void);
+
+/*
+ * Destructor: Stops the workers and frees the pool
+ */
+void pool_delete(Pool *p);
+
+#endif
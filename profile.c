@@ -0,0 +1,89 @@
+#include "profile.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+// counters of one thread, kept until exit so they can be reported
+typedef struct ProfileThread {
+    ProfileCounter counters[PROF_SLOTS];
+    struct ProfileThread *next;
+} ProfileThread;
+
+static const char *const names[PROF_SLOTS] = {
+    [PROF_ENCODE_SPAN] = "encode_span",
+    [PROF_TRIE_STEP] = "trie_step",
+    [PROF_TRIE_NODE_CREATE] = "trie_node_create",
+    [PROF_WRITE_PAIR] = "write_pair",
+    [PROF_WRITE_PAIRS] = "write_pairs",
+    [PROF_READ_BYTES] = "read_bytes",
+    [PROF_READ_PAIR] = "read_pair",
+    [PROF_WT_SPELL] = "wt_spell",
+    [PROF_WRITE_WORD] = "write_word",
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static ProfileThread *threads;
+
+_Thread_local ProfileCounter *profile_counters;
+ProfileCounter profile_lost[PROF_SLOTS];
+
+// set up the counters of the calling thread
+ProfileCounter *profile_thread(void) {
+    ProfileThread *t = calloc(1, sizeof(ProfileThread));
+    if (!t) {
+        profile_counters = profile_lost;
+        return profile_lost;
+    }
+    pthread_mutex_lock(&lock);
+    t->next = threads;
+    threads = t;
+    pthread_mutex_unlock(&lock);
+    profile_counters = t->counters;
+    return t->counters;
+}
+
+// a line of the report
+typedef struct Row {
+    const char *name;
+    uint64_t calls;
+    uint64_t ticks;
+} Row;
+
+// order rows by ticks, most first
+static int by_ticks(const void *a, const void *b) {
+    const Row *x = a, *y = b;
+    return (x->ticks < y->ticks) - (x->ticks > y->ticks);
+}
+
+// print the totals over all threads, most expensive first
+static void profile_report(void) {
+    Row rows[PROF_SLOTS];
+    for (int s = 0; s < PROF_SLOTS; s += 1) {
+        rows[s] = (Row) { names[s], __atomic_load_n(&profile_lost[s].calls, __ATOMIC_RELAXED),
+            __atomic_load_n(&profile_lost[s].ticks, __ATOMIC_RELAXED) };
+    }
+    pthread_mutex_lock(&lock);
+    for (ProfileThread *t = threads; t; t = t->next) {
+        for (int s = 0; s < PROF_SLOTS; s += 1) {
+            rows[s].calls += t->counters[s].calls;
+            rows[s].ticks += t->counters[s].ticks;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    qsort(rows, PROF_SLOTS, sizeof(Row), by_ticks);
+    fprintf(stderr, "%-18s %14s %16s %10s\n", "function", "calls", PROFILE_UNIT, "per call");
+    for (int s = 0; s < PROF_SLOTS; s += 1) {
+        if (rows[s].calls) {
+            fprintf(stderr, "%-18s %14" PRIu64 " %16" PRIu64 " %10.1f\n", rows[s].name,
+                rows[s].calls, rows[s].ticks, (double) rows[s].ticks / rows[s].calls);
+        }
+    }
+}
+
+// report once the program exits, however it gets there
+__attribute__((constructor)) static void profile_init(void) {
+    atexit(profile_report);
+}
@@ -0,0 +1,88 @@
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+/*
+ * Hot path counters for the profiling build, make profile
+ * Built with -DLZ78_PROFILE, PROFILE(slot) at the top of a function counts
+ * its calls and the cycles (ns where there's no cycle counter) until it
+ * returns, including whatever it calls. Each thread counts on its own, or
+ * atomically in shared counters if it can't get its own, and the totals over
+ * all threads are printed on stderr at exit, most expensive first. Without
+ * LZ78_PROFILE, PROFILE(slot) compiles to nothing.
+ */
+typedef enum ProfileSlot {
+    PROF_ENCODE_SPAN, // Greedy encoder over one span of input.
+    PROF_TRIE_STEP,
+    PROF_TRIE_NODE_CREATE,
+    PROF_WRITE_PAIR,
+    PROF_WRITE_PAIRS, // A batch of pairs from encode_span().
+    PROF_READ_BYTES, // Input read from a file descriptor.
+    PROF_READ_PAIR,
+    PROF_WT_SPELL, // Symbols of a decoded word, from its prefix codes.
+    PROF_WRITE_WORD,
+    PROF_SLOTS,
+} ProfileSlot;
+
+#ifdef LZ78_PROFILE
+
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILE_UNIT "cycles"
+#else
+#include <time.h>
+#define PROFILE_UNIT "ns"
+#endif
+
+typedef struct ProfileCounter {
+    uint64_t calls;
+    uint64_t ticks;
+} ProfileCounter;
+
+// a function being counted, from PROFILE() until it returns
+typedef struct ProfileMark {
+    ProfileSlot slot;
+    uint64_t start;
+} ProfileMark;
+
+extern _Thread_local ProfileCounter *profile_counters;
+extern ProfileCounter profile_lost[PROF_SLOTS]; // Shared by threads that can't get their own.
+
+/*
+ * Returns the counters of the calling thread, set up on its first count
+ */
+ProfileCounter *profile_thread(void);
+
+static inline uint64_t profile_now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static inline void profile_stop(ProfileMark *m) {
+    uint64_t ticks = profile_now() - m->start;
+    ProfileCounter *c = profile_counters ? profile_counters : profile_thread();
+    if (c == profile_lost) {
+        __atomic_fetch_add(&c[m->slot].calls, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&c[m->slot].ticks, ticks, __ATOMIC_RELAXED);
+        return;
+    }
+    c[m->slot].calls += 1;
+    c[m->slot].ticks += ticks;
+}
+
+#define PROFILE(slot)                                                                              \
+    __attribute__((cleanup(profile_stop))) ProfileMark profile_mark = { (slot), profile_now() }
+
+#else
+
+#define PROFILE(slot) (void) 0
+
+#endif
+
+#endif
@@ -0,0 +1,84 @@
+#include "report.h"
+#include "lz78.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/resource.h>
+
+// peak resident memory of this process in KB
+static long peak_rss_kb(void) {
+    struct rusage ru;
+    return getrusage(RUSAGE_SELF, &ru) == 0 ? ru.ru_maxrss : 0;
+}
+
+// MB/s for bytes in ns
+static double mbps(uint64_t bytes, uint64_t ns) {
+    return ns ? (double) bytes / (1 << 20) / ((double) ns / 1e9) : 0.0;
+}
+
+// compressed bits rounded up to bytes
+static uint64_t comp_bytes(const LZ78Stats *stats) {
+    return (stats->bits + 7) / 8;
+}
+
+// print the human readable statistics
+void report_text(FILE *f, const LZ78Stats *stats, uint64_t wall_ns) {
+    fprintf(f, "Wall time: %.3f s (read %.3f s, codec %.3f s, write %.3f s)\n", wall_ns / 1e9,
+        stats->read_ns / 1e9, stats->codec_ns / 1e9, stats->write_ns / 1e9);
+    fprintf(f, "Throughput: %.2f MB/s (codec %.2f MB/s)\n", mbps(stats->syms, wall_ns),
+        mbps(stats->syms, stats->codec_ns));
+    fprintf(f, "Dictionary resets: %" PRIu64 "\n", stats->resets);
+    fprintf(f, "Stored uncompressed: %" PRIu64 " bytes\n", stats->stored);
+    fprintf(f, "Peak dictionary entries: %" PRIu64 "\n", stats->entries);
+    fprintf(f, "Peak memory: %ld KB\n", peak_rss_kb());
+    // only buckets that were hit
+    fprintf(f, "Phrase lengths:");
+    for (int i = 0; i < PHRASE_BUCKETS; i += 1) {
+        if (stats->phrase_lens[i]) {
+            uint64_t lo = UINT64_C(1) << i;
+            uint64_t hi = (UINT64_C(1) << (i + 1)) - 1;
+            if (lo == hi) {
+                fprintf(f, " %" PRIu64 ":%" PRIu64, lo, stats->phrase_lens[i]);
+            } else {
+                fprintf(f, " %" PRIu64 "-%" PRIu64 ":%" PRIu64, lo, hi, stats->phrase_lens[i]);
+            }
+        }
+    }
+    fprintf(f, "\nCode widths:");
+    for (int i = 0; i <= MAX_BITS; i += 1) {
+        if (stats->code_widths[i]) {
+            fprintf(f, " %d:%" PRIu64, i, stats->code_widths[i]);
+        }
+    }
+    fprintf(f, "\n");
+}
+
+// print a JSON array of n counts
+static void json_counts(FILE *f, const char *key, const uint64_t *counts, int n) {
+    fprintf(f, ", \"%s\": [", key);
+    for (int i = 0; i < n; i += 1) {
+        fprintf(f, i ? ", %" PRIu64 : "%" PRIu64, counts[i]);
+    }
+    fprintf(f, "]");
+}
+
+// print all statistics as one JSON object
+void report_json(
+    FILE *f, const char *program, const char *mode, const LZ78Stats *stats, uint64_t wall_ns) {
+    fprintf(f, "{\"version\": %d, \"program\": \"%s\", \"mode\": \"%s\"", REPORT_VERSION, program,
+        mode);
+    fprintf(f, ", \"uncompressed_bytes\": %" PRIu64 ", \"compressed_bytes\": %" PRIu64,
+        stats->syms, comp_bytes(stats));
+    fprintf(f, ", \"wall_ns\": %" PRIu64 ", \"read_ns\": %" PRIu64 ", \"codec_ns\": %" PRIu64
+               ", \"write_ns\": %" PRIu64,
+        wall_ns, stats->read_ns, stats->codec_ns, stats->write_ns);
+    fprintf(f, ", \"mbps\": %.3f, \"codec_mbps\": %.3f", mbps(stats->syms, wall_ns),
+        mbps(stats->syms, stats->codec_ns));
+    fprintf(f, ", \"resets\": %" PRIu64 ", \"dict_entries\": %" PRIu64 ", \"dict_bytes\": %" PRIu64,
+        stats->resets, stats->entries, stats->dict_bytes);
+    fprintf(f, ", \"stored_bytes\": %" PRIu64, stats->stored);
+    fprintf(f, ", \"peak_rss_kb\": %ld", peak_rss_kb());
+    json_counts(f, "phrase_lens", stats->phrase_lens, PHRASE_BUCKETS);
+    json_counts(f, "code_widths", stats->code_widths, MAX_BITS + 1);
+    fprintf(f, "}\n");
+}
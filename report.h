@@ -0,0 +1,25 @@
+#ifndef __REPORT_H__
+#define __REPORT_H__
+
+#include "lz78.h"
+#include <stdio.h>
+#include <stdint.h>
+
+#define REPORT_VERSION 1 // Bumped whenever a JSON field changes meaning or goes away.
+
+/*
+ * Prints the statistics after the basic -v ones: timings, throughput,
+ * dictionary behaviour and histograms, one per line
+ * wall_ns is the time the whole run took
+ */
+void report_text(FILE *f, const LZ78Stats *stats, uint64_t wall_ns);
+
+/*
+ * Prints every statistic as a single line JSON object
+ * program is "encode" or "decode", mode is "stream" or "chunked"
+ * The keys and their meaning stay the same for a given REPORT_VERSION
+ */
+void report_json(
+    FILE *f, const char *program, const char *mode, const LZ78Stats *stats, uint64_t wall_ns);
+
+#endif
@@ -0,0 +1,328 @@
+#include "seek.h"
+#include "crc32c.h"
+#include "endian.h"
+#include "io.h"
+#include "lz78.h"
+#include "pool.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define PIECE (1 << 16) // Input fed to a segment's decoder at a time, between checks on the range.
+
+// the seek index at the end of a stream
+typedef struct Index {
+    const uint8_t *entries;
+    uint32_t count;
+    uint64_t length; // Uncompressed length of the stream.
+    uint64_t offset; // Where the index starts, right after the stream.
+} Index;
+
+typedef struct Batch Batch;
+
+// the codes from one reset up to the next
+typedef struct Segment {
+    uint64_t bit; // Where its codes start, 0 for a stream read from its start.
+    uint64_t end; // Byte its input runs up to.
+    uint64_t sym; // Offset of its output in the stream's.
+    uint64_t syms; // Output it comes to, LZ78_UNKNOWN_LENGTH if the index doesn't say.
+    bool last; // Runs up to STOP_CODE rather than the next reset.
+    Batch *batch;
+    uint64_t pos; // Offset in the stream's output of the next byte it decodes.
+    uint32_t crc; // Of all of its output, when the whole stream is checked.
+    bool direct; // Writes its part of the range straight out, the ones before it are written.
+    Buffer out; // Its part of the range otherwise, written after the ones before it.
+    LZ78Stats stats;
+    LZ78Status status;
+} Segment;
+
+// what the jobs of a batch share
+struct Batch {
+    Segment *segments;
+    const uint8_t *buf; // The stream.
+    int head_size;
+    const LZ78Dict *dict;
+    uint64_t offset; // Range of the output written, [offset, end).
+    uint64_t end;
+    bool whole; // Every segment is decoded to its end.
+    bool crc; // And checksummed, for checking the stream's checksum.
+    int outfile; // -1 to write nothing.
+    bool positioned; // outfile is a regular file, segments write their part where it goes.
+    uint64_t base; // Where the range starts in it.
+};
+
+// find the index at the end of the stream at buf[0..len) and check it fits the stream
+static bool read_index(const uint8_t *buf, size_t len, Index *index) {
+    if (len < HEADER_SIZE + INDEX_HEAD_SIZE + INDEX_FOOTER_SIZE) {
+        return false;
+    }
+    FileHeader header;
+    read_header(buf, &header);
+    const uint8_t *footer = buf + len - INDEX_FOOTER_SIZE;
+    if (header.magic != MAGIC || load_le32(footer + 8) != MAGIC_INDEX) {
+        return false;
+    }
+    uint64_t head_size = header_size(header.flags);
+    index->offset = load_le64(footer);
+    if (index->offset < head_size || index->offset > len - INDEX_HEAD_SIZE - INDEX_FOOTER_SIZE) {
+        return false;
+    }
+    index->count = load_le32(buf + index->offset);
+    index->length = load_le64(buf + index->offset + 4);
+    index->entries = buf + index->offset + INDEX_HEAD_SIZE;
+    uint64_t size = (uint64_t) index->count * INDEX_ENTRY_SIZE;
+    if (index->offset + INDEX_HEAD_SIZE + size + INDEX_FOOTER_SIZE != len) {
+        return false;
+    }
+    // resets come in order, after the header and before the end of the stream
+    uint64_t bit = head_size * 8;
+    uint64_t sym = 0;
+    for (uint32_t i = 0; i < index->count; i += 1) {
+        const uint8_t *entry = index->entries + (size_t) i * INDEX_ENTRY_SIZE;
+        uint64_t next_bit = load_le64(entry);
+        uint64_t next_sym = load_le64(entry + 8);
+        if (next_bit <= bit || next_bit > index->offset * 8 || next_sym < sym
+            || next_sym > index->length) {
+            return false;
+        }
+        bit = next_bit;
+        sym = next_sym;
+    }
+    // a recorded length has to agree
+    if (header.flags & FLAG_SIZE && len >= head_size
+        && load_le64(buf + head_size - LENGTH_SIZE) != index->length) {
+        return false;
+    }
+    return true;
+}
+
+// check for a seek index
+bool seek_indexed(const uint8_t *buf, size_t len) {
+    Index index;
+    return read_index(buf, len, &index);
+}
+
+// segment k of an indexed stream, segment 0 starting after the header
+static void index_segment(const Index *index, int head_size, uint32_t k, Segment *seg) {
+    memset(seg, 0, sizeof(Segment));
+    if (k > 0) {
+        const uint8_t *entry = index->entries + (size_t) (k - 1) * INDEX_ENTRY_SIZE;
+        seg->bit = load_le64(entry);
+        seg->sym = load_le64(entry + 8);
+    } else {
+        seg->bit = (uint64_t) head_size * 8;
+    }
+    seg->last = k == index->count;
+    if (seg->last) {
+        seg->end = index->offset;
+        seg->syms = index->length - seg->sym;
+    } else {
+        const uint8_t *entry = index->entries + (size_t) k * INDEX_ENTRY_SIZE;
+        seg->end = (load_le64(entry) + 7) / 8;
+        seg->syms = load_le64(entry + 8) - seg->sym;
+    }
+}
+
+// sink of a segment's decoder: skip what's before the range, drop what's past it
+static bool segment_sink(void *ctx, const uint8_t *buf, size_t len) {
+    Segment *seg = ctx;
+    Batch *b = seg->batch;
+    uint64_t pos = seg->pos;
+    seg->pos += len;
+    if (b->crc) {
+        seg->crc = crc32c(seg->crc, buf, len);
+    }
+    uint64_t lo = b->offset > pos ? b->offset - pos : 0;
+    uint64_t hi = b->end > pos ? b->end - pos : 0;
+    hi = hi < len ? hi : len;
+    if (lo >= hi || b->outfile == -1) {
+        return true;
+    } else if (b->positioned) {
+        return write_at(b->outfile, buf + lo, hi - lo, b->base + pos + lo - b->offset);
+    } else if (seg->direct) {
+        return fd_sink(&b->outfile, buf + lo, hi - lo);
+    }
+    return buffer_sink(&seg->out, buf + lo, hi - lo);
+}
+
+// job: decompress segment i of the batch
+static void decode_segment(void *arg, int i) {
+    Batch *b = arg;
+    Segment *seg = &b->segments[i];
+    seg->batch = b;
+    seg->pos = seg->sym;
+    LZ78Decoder *dec = lz78_decoder_create(segment_sink, seg);
+    if (!dec) {
+        seg->status = LZ78_ERR_MEMORY;
+        return;
+    }
+    lz78_decoder_use_dict(dec, b->dict);
+    // past the header its input starts with the byte holding its first code
+    uint64_t from = seg->bit / 8;
+    seg->status = LZ78_OK;
+    if (seg->bit) {
+        uint64_t syms = seg->last ? LZ78_UNKNOWN_LENGTH : seg->syms;
+        seg->status = lz78_decoder_seek(dec, b->buf, b->head_size, seg->bit, syms);
+    }
+    // a piece at a time, so decoding stops once the range is out
+    bool cut = false;
+    for (uint64_t at = from; seg->status == LZ78_OK && at < seg->end && !cut;) {
+        size_t piece = seg->end - at < PIECE ? seg->end - at : PIECE;
+        seg->status = lz78_decoder_update(dec, b->buf + at, piece);
+        at += piece;
+        lz78_decoder_stats(dec, &seg->stats);
+        cut = !b->whole && seg->sym + seg->stats.syms >= b->end;
+    }
+    if (seg->status == LZ78_OK) {
+        seg->status = lz78_decoder_finish(dec);
+        // the rest of a segment cut short is never read, so it can't be checked either
+        if (cut && seg->status == LZ78_ERR_TRUNCATED) {
+            seg->status = LZ78_OK;
+        }
+    }
+    lz78_decoder_stats(dec, &seg->stats);
+    lz78_decoder_delete(dec);
+    // only the segment's own bits count, the header is counted once for all of them
+    seg->stats.bits -= from * 8;
+    if (seg->status == LZ78_OK && !cut && seg->syms != LZ78_UNKNOWN_LENGTH
+        && seg->pos - seg->sym != seg->syms) {
+        seg->status = LZ78_ERR_INDEX;
+    }
+}
+
+// decompress a range of a stream through its seek index
+LZ78Status seek_decode(const uint8_t *buf, size_t len, int outfile, uint64_t offset,
+    uint64_t length, int threads, const LZ78Dict *dict, LZ78Stats *stats) {
+    memset(stats, 0, sizeof(LZ78Stats));
+    if (len < HEADER_SIZE) {
+        return LZ78_ERR_TRUNCATED;
+    }
+    FileHeader header;
+    read_header(buf, &header);
+    if (header.magic != MAGIC) {
+        return LZ78_ERR_MAGIC;
+    }
+    int head_size = header_size(header.flags);
+    if (len < (size_t) head_size) {
+        return LZ78_ERR_TRUNCATED;
+    }
+    // the range ends at the end of the output, if the index says where that is
+    uint64_t end = length > UINT64_MAX - offset ? UINT64_MAX : offset + length;
+    Index index;
+    bool indexed = read_index(buf, len, &index);
+    if (indexed && end > index.length) {
+        end = index.length;
+    }
+    // from the last reset up to offset to the last one before the end
+    // a range covering all of the output takes every segment, however short
+    bool whole = indexed && offset == 0 && end == index.length;
+    uint32_t first = 0;
+    uint32_t last = indexed ? index.count : 0;
+    for (uint32_t k = 1; indexed && !whole && k <= index.count; k += 1) {
+        uint64_t sym = load_le64(index.entries + (size_t) (k - 1) * INDEX_ENTRY_SIZE + 8);
+        if (sym <= offset) {
+            first = k;
+        }
+        if (sym >= end) {
+            last = k - 1;
+            break;
+        }
+    }
+    if (indexed && !whole && offset >= end) {
+        return LZ78_OK;
+    }
+    // a regular file is written where each segment's output goes, by the workers
+    // anything else in order: the first segment of a batch writes as it goes,
+    // the ones after it keep their part of the range until it's their turn
+    struct stat st;
+    off_t base = outfile != -1 && fstat(outfile, &st) == 0 && S_ISREG(st.st_mode)
+                     ? lseek(outfile, 0, SEEK_CUR)
+                     : -1;
+    if (whole && outfile != -1) {
+        uint64_t bound = lz78_max_length(&header, len);
+        preallocate(outfile, index.length < bound ? index.length : bound);
+    }
+
+    Pool *pool = pool_create(threads);
+    int batch_size = 2 * threads;
+    Segment *segments = calloc(batch_size, sizeof(Segment));
+    if (!pool || !segments) {
+        pool_delete(pool);
+        free(segments);
+        return LZ78_ERR_MEMORY;
+    }
+    Batch batch = { segments, buf, head_size, dict, offset, end, whole,
+        whole && header.flags & FLAG_CRC, outfile, base != -1, base != -1 ? base : 0 };
+    LZ78Status status = LZ78_OK;
+    uint32_t crc = 0;
+    uint64_t written = offset;
+    uint64_t next = first;
+    while (status == LZ78_OK && next <= last) {
+        // the index says where each segment is, workers read their own
+        uint64_t start = clock_ns();
+        int n = 0;
+        for (; n < batch_size && next <= last; n += 1, next += 1) {
+            Segment *seg = &segments[n];
+            if (indexed) {
+                index_segment(&index, head_size, next, seg);
+            } else {
+                // without an index the stream is one segment, read from its start
+                memset(seg, 0, sizeof(Segment));
+                seg->end = len;
+                seg->syms = LZ78_UNKNOWN_LENGTH;
+                seg->last = true;
+            }
+            seg->direct = n == 0;
+        }
+        uint64_t read = clock_ns();
+        pool_run(pool, decode_segment, &batch, n);
+        uint64_t codec = clock_ns();
+        stats->read_ns += read - start;
+        stats->codec_ns += codec - read;
+
+        // write out what the segments kept of the range, in order
+        for (int i = 0; i < n; i += 1) {
+            Segment *seg = &segments[i];
+            if (status == LZ78_OK) {
+                status = seg->status;
+            }
+            if (status == LZ78_OK && seg->out.len
+                && !fd_sink(&outfile, seg->out.data, seg->out.len)) {
+                status = LZ78_ERR_SINK;
+            }
+            if (batch.crc) {
+                crc = crc32c_combine(crc, seg->crc, seg->pos - seg->sym);
+            }
+            written = seg->pos > written ? (seg->pos < end ? seg->pos : end) : written;
+            lz78_stats_merge(stats, &seg->stats);
+            free(seg->out.data);
+        }
+        stats->write_ns += clock_ns() - codec;
+    }
+    // leave a regular file's offset after the range, as if it was written in order
+    if (batch.positioned) {
+        lseek(outfile, base + (written - offset), SEEK_SET);
+    }
+    // segments check their own lengths, all of them together have the checksum to meet
+    // it's right ahead of the index, from the byte after the STOP_CODE
+    if (status == LZ78_OK && whole && header.flags & FLAG_CRC
+        && (index.offset < (uint64_t) head_size + CRC_SIZE
+            || crc != load_le32(buf + index.offset - CRC_SIZE))) {
+        status = LZ78_ERR_CHECKSUM;
+    }
+    // the header is read once for every segment, and the whole stream includes the index
+    if (whole) {
+        stats->bits = (uint64_t) len * 8;
+    } else if (indexed) {
+        stats->bits += (uint64_t) head_size * 8;
+    }
+
+    pool_delete(pool);
+    free(segments);
+    return status;
+}
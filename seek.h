@@ -0,0 +1,32 @@
+#ifndef __SEEK_H__
+#define __SEEK_H__
+
+#include "lz78.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Returns true if the stream at buf[0..len) ends with a seek index that
+ * fits it, see MAGIC_INDEX
+ */
+bool seek_indexed(const uint8_t *buf, size_t len);
+
+/*
+ * Decompresses bytes [offset, offset + length) of the output of the stream
+ * at buf[0..len) to outfile, length LZ78_UNKNOWN_LENGTH for all the rest
+ * With a seek index decompression starts at the last reset up to offset and
+ * ends at the first one past the range, the segments between resets are
+ * decompressed on threads workers. Without one the stream is decompressed
+ * from its start. Either way decoding stops once the range is out, and only
+ * the range is written: into a regular file by the workers, where each
+ * segment's part goes, in order to anything else, so little is buffered.
+ * Output of the whole stream is checked against its checksum and length
+ * With outfile -1 the range is only checked, nothing is written
+ * dict is used by streams compressed with a pretrained dictionary, may be NULL
+ * Fills stats with the totals over the segments decompressed
+ */
+LZ78Status seek_decode(const uint8_t *buf, size_t len, int outfile, uint64_t offset,
+    uint64_t length, int threads, const LZ78Dict *dict, LZ78Stats *stats);
+
+#endif
@@ -1,37 +1,93 @@
 #include "trie.h"
 #include "code.h"
+#include "profile.h"
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
-// constructor for TrieNode
-TrieNode *trie_node_create(uint16_t code) {
-    // allocate memory for TrieNode ADT
-    TrieNode *n = (TrieNode *) calloc(1, sizeof(TrieNode));
-    // if successful, set code and children node pointers to NULL
-    if (n) {
-        n->code = code;
-        for (int i = 0; i < ALPHABET; i += 1) {
-            n->children[i] = NULL;
+#define SLAB_SIZE (256 * 1024) // 256KB slabs.
+
+// a slab of memory that nodes and child arrays are carved from
+typedef struct Slab Slab;
+
+struct Slab {
+    Slab *next;
+    size_t used;
+    uint8_t data[];
+};
+
+// the arena backing one trie, the root comes first so it identifies the arena
+typedef struct TrieArena {
+    TrieNode root;
+    Slab *slabs;
+    Slab *curr;
+    size_t reserved;
+} TrieArena;
+
+// bytes taken by a child array with room for cap children
+static size_t children_size(uint16_t cap) {
+    // dense tables only hold pointers, packed arrays also hold a symbol per child
+    if (cap == ALPHABET) {
+        return ALPHABET * sizeof(TrieNode *);
+    }
+    return cap * (sizeof(TrieNode *) + sizeof(uint8_t));
+}
+
+// carve size bytes out of the arena, moving on to the next slab when full
+static void *arena_alloc(TrieArena *a, size_t size) {
+    // keep everything pointer aligned
+    size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    while (!a->curr || a->curr->used + size > SLAB_SIZE) {
+        if (a->curr && a->curr->next) {
+            // reuse a slab left over from before the last reset
+            a->curr = a->curr->next;
+            a->curr->used = 0;
+            continue;
+        }
+        // out of slabs, allocate a new one and chain it on
+        Slab *slab = malloc(sizeof(Slab) + SLAB_SIZE);
+        if (!slab) {
+            return NULL;
         }
+        slab->next = NULL;
+        slab->used = 0;
+        if (a->curr) {
+            a->curr->next = slab;
+        } else {
+            a->slabs = slab;
+        }
+        a->curr = slab;
+        a->reserved += sizeof(Slab) + SLAB_SIZE;
     }
-    return n;
+    void *p = a->curr->data + a->curr->used;
+    a->curr->used += size;
+    return p;
 }
 
-// desctructor for TrieNode
-void trie_node_delete(TrieNode *n) {
+// constructor for TrieNode, carved out of arena a
+static TrieNode *trie_node_create(TrieArena *a, uint32_t code) {
+    PROFILE(PROF_TRIE_NODE_CREATE);
+    TrieNode *n = arena_alloc(a, sizeof(TrieNode));
+    // if successful, set code, children are allocated on first insert
     if (n) {
-        free(n);
+        n->children = NULL;
+        n->count = 0;
+        n->cap = 0;
+        n->code = code;
     }
+    return n;
 }
 
 // initialize a trie
 TrieNode *trie_create(void) {
-    // initialize root TrieNode with EMPTY_CODE
-    TrieNode *root = trie_node_create(EMPTY_CODE);
+    // allocate the arena, its root TrieNode gets EMPTY_CODE
+    TrieArena *a = calloc(1, sizeof(TrieArena));
     // if successful, return root
-    if (root) {
-        return root;
+    if (a) {
+        a->root.code = EMPTY_CODE;
+        a->reserved = sizeof(TrieArena);
+        return &a->root;
     } // otherwise, false
     return NULL;
 }
@@ -40,42 +96,86 @@ TrieNode *trie_create(void) {
 void trie_reset(TrieNode *root) {
     // if root exists
     if (root) {
-        // looping through root's children (0 - 255)
-        for (int i = 0; i < ALPHABET; i += 1) {
-            // delete child node and all of it's children
-            if (root->children[i]) {
-                trie_delete(root->children[i]);
-                root->children[i] = NULL;
-            }
+        TrieArena *a = (TrieArena *) root;
+        // forget the root's children, their memory is in the arena
+        root->children = NULL;
+        root->count = 0;
+        root->cap = 0;
+        // rewind the arena to the start of the first slab
+        a->curr = a->slabs;
+        if (a->curr) {
+            a->curr->used = 0;
         }
     }
 }
 
-// delete a sub-trie starting from trie rooted at node n
-void trie_delete(TrieNode *n) {
-    // if n exists
-    if (n) {
-        // looping through n's children (0 - 255)
-        for (int i = 0; i < ALPHABET; i += 1) {
-            // if child exists at index i
-            if (n->children[i]) {
-                // recursive call to check if that child has more children
-                trie_delete(n->children[i]);
-            }
+// delete a trie by releasing its arena
+void trie_delete(TrieNode *root) {
+    // if root exists
+    if (root) {
+        TrieArena *a = (TrieArena *) root;
+        // free every slab, then the arena itself
+        Slab *slab = a->slabs;
+        while (slab) {
+            Slab *next = slab->next;
+            free(slab);
+            slab = next;
         }
-        // once we hit node w/o children, delete node
-        trie_node_delete(n);
-        // set pointer to NULl
-        n = NULL;
+        free(a);
     }
 }
 
-// return a pointer to child node representing the sym, NULL if sym doesn't exist
-TrieNode *trie_step(TrieNode *n, uint8_t sym) {
-    // if child with index sym exists, pointer will return child node, otherwise NULL
-    if (n->children[sym]) {
-        return n->children[sym];
-    } else {
+// bytes reserved by the arena
+size_t trie_memory(TrieNode *root) {
+    return root ? ((TrieArena *) root)->reserved : 0;
+}
+
+// grow the child array of node n to the next capacity
+static int grow(TrieArena *a, TrieNode *n) {
+    // double the packed capacity, switching to a dense table past PACKED_MAX
+    uint16_t cap = n->cap ? n->cap * 2 : 2;
+    if (cap > PACKED_MAX) {
+        cap = ALPHABET;
+    }
+    TrieNode **children = arena_alloc(a, children_size(cap));
+    if (!children) {
+        return 0;
+    }
+    if (cap == ALPHABET) {
+        // scatter packed children into the dense table by symbol
+        memset(children, 0, children_size(cap));
+        uint8_t *syms = trie_syms(n);
+        for (uint16_t i = 0; i < n->count; i += 1) {
+            children[syms[i]] = n->children[i];
+        }
+    } else if (n->count) {
+        // copy pointers and symbols into their new places
+        memcpy(children, n->children, n->count * sizeof(TrieNode *));
+        memcpy((uint8_t *) (children + cap), trie_syms(n), n->count);
+    }
+    // the old array stays in the arena until the next reset
+    n->children = children;
+    n->cap = cap;
+    return 1;
+}
+
+// add a child called sym to node n
+TrieNode *trie_insert(TrieNode *root, TrieNode *n, uint8_t sym, uint32_t code) {
+    TrieArena *a = (TrieArena *) root;
+    // make room for the new child if the node is full
+    if (n->cap != ALPHABET && n->count == n->cap && !grow(a, n)) {
         return NULL;
     }
+    TrieNode *child = trie_node_create(a, code);
+    if (!child) {
+        return NULL;
+    }
+    if (n->cap == ALPHABET) {
+        n->children[sym] = child;
+    } else {
+        n->children[n->count] = child;
+        trie_syms(n)[n->count] = sym;
+    }
+    n->count += 1;
+    return child;
 }
@@ -1,56 +1,91 @@
 #ifndef __TRIE_H__
 #define __TRIE_H__
 
+#include "profile.h"
+
+#include <stddef.h>
 #include <stdint.h>
 
 #define ALPHABET 256
+#define PACKED_MAX 32 // Children kept packed up to this many, dense table after.
 
 typedef struct TrieNode TrieNode;
 
+/*
+ * A node only holds as many child slots as it has children.
+ * While cap <= PACKED_MAX, children[0..count) are packed and their symbols
+ * are stored right after the pointers (see trie_syms()).
+ * Once a node outgrows PACKED_MAX it switches to a dense table of ALPHABET
+ * pointers indexed directly by symbol (cap == ALPHABET).
+ */
 struct TrieNode {
-    TrieNode *children[ALPHABET];
-    uint16_t code;
+    TrieNode **children;
+    uint16_t count;
+    uint16_t cap;
+    uint32_t code;
 };
 
 /*
- * Creates a new TrieNode and returns a pointer to it
- * Allocate memory for TrieNode
- * Code is the code to be assigned to this new node
- * Returns the newly allocated node
+ * Constructor: Creates the root TrieNode and returns a pointer to it
+ * The root owns an arena that every node and child array of the trie is
+ * carved from, so nodes are never allocated or freed one at a time
+ * Code is EMPTY_CODE
+ * Returns the newly allocated root
+ */
+TrieNode *trie_create(void);
+
+/*
+ * Resets the trie: called when code reaches the dictionary's MAX_CODE
+ * Rewinds the arena of root so its memory is reused by the next nodes
+ * Runs in constant time, no nodes are visited
  */
-TrieNode *trie_node_create(uint16_t code);
+void trie_reset(TrieNode *root);
 
 /*
- * Deletes Node n
- * Frees any allocated memory
+ * Destructor: Deletes the trie rooted at root
+ * Releases the whole arena in one go
  */
-void trie_node_delete(TrieNode *n);
+void trie_delete(TrieNode *root);
 
 /*
- * Constructor: Creates the root TrieNode and returns a pointer to it
- * Allocate memory for TrieNode
- * Code is START_CODE
- * Returns the newly allocated node
+ * Returns the bytes reserved by the arena of the trie at root
+ * Arenas only grow until deleted, so this is also the peak
  */
-TrieNode *trie_create(void);
+size_t trie_memory(TrieNode *root);
 
 /*
- * Resets the trie: called when code reaches MAX_CODE
- * Deletes all the children of root and frees allocated memory
+ * Adds a child called sym with the given code to node n of the trie at root
+ * Grows the child array of n if it is full
+ * Returns the new child, NULL if allocation failed
  */
-void trie_reset(TrieNode *root);
+TrieNode *trie_insert(TrieNode *root, TrieNode *n, uint8_t sym, uint32_t code);
 
 /*
- * Destructor: Deletes all nodes starting at n as the root
- * Deletes any children recursively before deleting the root
- * Frees all the memory allocated for TrieNodes n and below
+ * Returns the symbols of the packed children of node n
+ * Only valid while n->cap <= PACKED_MAX
  */
-void trie_delete(TrieNode *n);
+static inline uint8_t *trie_syms(TrieNode *n) {
+    return (uint8_t *) (n->children + n->cap);
+}
 
 /*
  * Checks if node has any children called sym
  * Returns the address if found, NULL if absent
  */
-TrieNode *trie_step(TrieNode *n, uint8_t sym);
+static inline TrieNode *trie_step(TrieNode *n, uint8_t sym) {
+    PROFILE(PROF_TRIE_STEP);
+    // dense node, index the table directly
+    if (n->cap == ALPHABET) {
+        return n->children[sym];
+    }
+    // packed node, scan the symbols of the children
+    uint8_t *syms = trie_syms(n);
+    for (uint16_t i = 0; i < n->count; i += 1) {
+        if (syms[i] == sym) {
+            return n->children[i];
+        }
+    }
+    return NULL;
+}
 
 #endif
@@ -1,44 +1,40 @@
 #ifndef __WORD_H__
 #define __WORD_H__
 
+#include "profile.h"
 #include <stdint.h>
 
-typedef struct Word {
-    uint8_t *syms;
-    uint32_t len;
-} Word;
-
-typedef Word *WordTable;
-
 /*
- * Creates a new Word with symbols syms and length len
- * Allocates new array and copies the symbols over
+ * A word in the table is stored as the code of the word it extends plus the
+ * symbol appended to it, so adding a word never copies its prefix.
+ * The symbols of a word are recovered by walking the prefix codes back to
+ * EMPTY_CODE (see wt_spell()).
  */
-Word *word_create(uint8_t *syms, uint32_t len);
+typedef struct WordEntry {
+    uint32_t prefix;
+    uint8_t sym;
+    uint8_t first; // First symbol of the word, for LZW's words that end in it.
+    uint32_t len;
+} WordEntry;
 
-/*
- * Creates a new word by appending symbol sym to word w
- * Updates the length of the new word and copies symbols over
- * Returns a pointer to the newly allocated word
- */
-Word *word_append_sym(Word *w, uint8_t sym);
+typedef WordEntry WordTable;
 
 /*
- * Deletes the word w
- * Frees up associated space
+ * Constructor:
+ * Creates a new table big enough to fit codes up to max_code
+ * Creates the first element at EMPTY_CODE and returns it
  */
-void word_delete(Word *w);
+WordTable *wt_create(uint32_t max_code);
 
 /*
- * Constructor:
- * Creates a new table big enough to fit MAX_CODE
- * Creates the first element at EMPTY_CODE and returns it
+ * Adds the word made of the word at prefix followed by sym at code
+ * Constant time, only the prefix code and symbol are stored
  */
-WordTable *wt_create(void);
+void wt_add(WordTable *wt, uint32_t code, uint32_t prefix, uint8_t sym);
 
 /*
- * Deletes all words except EMPTY_CODE
- * Frees associated memory
+ * Resets the table to contain just EMPTY_CODE
+ * Constant time, stale entries are overwritten as codes are reused
  */
 void wt_reset(WordTable *wt);
 
@@ -48,4 +44,19 @@ void wt_reset(WordTable *wt);
  */
 void wt_delete(WordTable *wt);
 
+/*
+ * Writes the symbols of the word at code into out
+ * out must have room for wt[code].len symbols
+ */
+static inline void wt_spell(const WordTable *wt, uint32_t code, uint8_t *out) {
+    PROFILE(PROF_WT_SPELL);
+    // fill from the last symbol backwards, following prefix codes
+    uint32_t i = wt[code].len;
+    while (i > 0) {
+        i -= 1;
+        out[i] = wt[code].sym;
+        code = wt[code].prefix;
+    }
+}
+
 #endif